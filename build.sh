@@ -5,7 +5,7 @@ CONF_OPTS="";
 
 help()
 {
-    echo -e "usage\t$0 -[hdprtc]}\n" \
+    echo -e "usage\t$0 -[hdprtcis]}\n" \
             "  -d  : enable debug\n" \
             "  -p  : enable profile\n" \
             "  -r  : enable release\n" \
@@ -20,7 +20,7 @@ if [ ! -d autoconf ] ; then
     mkdir autoconf
 fi
 
-while getopts ":hdprtci" opt; do
+while getopts ":hdprtcis" opt; do
   case $opt in
     h)
       help;
@@ -37,12 +37,16 @@ while getopts ":hdprtci" opt; do
     i)
       CONF_OPTS="$CONF_OPTS --enable-inline=no"
       ;;
+    s)
+      CONF_OPTS="$CONF_OPTS --enable-stats"
+      ;;
     \?)
       echo "Invalid option: -$OPTARG" >&2
       ;;
   esac
 done
 
+libtoolize --copy --quiet
 aclocal
 autoheader
 automake --add-missing --copy
@@ -58,7 +62,7 @@ fi
 make -j$count
 
 OPTIND=0
-while getopts ":hdprtci" opt; do
+while getopts ":hdprtcis" opt; do
   case $opt in
     t) 
       make dist-bzip2
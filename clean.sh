@@ -20,10 +20,13 @@ rm -f *~
 
 find -name *~ -exec rm -f {} \; > /dev/null 2>&1
 find -name *.o -exec rm -f {} \; > /dev/null 2>&1
+find -name *.lo -exec rm -f {} \; > /dev/null 2>&1
+find -name .libs -exec rm -rf {} \; > /dev/null 2>&1
 
 find -name .dirstamp -exec rm -f {} \; > /dev/null 2>&1
 find -name .deps -exec rm -rf {} \; > /dev/null 2>&1
 
 rm -rf autom4te.cache/ stamp-h1 config.status install-sh \
         config.log aclocal.m4 Makefile Makefile.in configure config.status config.h \
-       config.h.in depcomp missing  INSTALL *.gdb configure.lineno > /dev/null 2>&1
+       config.h.in depcomp missing  INSTALL *.gdb configure.lineno \
+       libtool ltmain.sh config.guess config.sub compile ar-lib m4/ *.la > /dev/null 2>&1
@@ -0,0 +1,601 @@
+#include "bench.h"
+
+#include <getopt.h>
+#include <inttypes.h>       /* PRIu64 */
+#include <math.h>           /* sqrt */
+#include <sys/resource.h>   /* getrusage */
+
+#include "shared.h"
+#include "compress_lzw.h"
+#include "decompress_lzw.h"
+#include "timer.h"
+
+#define BENCH_LEVELS     15
+#define BENCH_SIZE       (16 << 20)
+#define BENCH_SIZE_MAX   (1 << 30)
+#define BENCH_REPEAT     3
+#define BENCH_SEED       0x64617461726f6c6cULL /* "datarol" */
+#define BENCH_MIX_CHUNK  (64 << 10)
+
+#define BENCH_JSON  0
+#define BENCH_CSV   1
+
+typedef void (*bench_gen)(uint8_t *, size_t, uint64_t *);
+
+typedef struct bench_corpus
+{
+    const char *name;
+    bench_gen   gen;
+} bench_corpus;
+
+typedef struct bench_result
+{
+    const char *corpus;
+    uint8_t     level;
+    size_t      in_len;
+    size_t      out_len;
+    double      comp_mean;
+    double      comp_dev;
+    double      decomp_mean;
+    double      decomp_dev;
+    long        rss_kb;
+} bench_result;
+
+/********* corpora *********/
+/* xorshift64*, corpora uguali a parità di seme su ogni macchina */
+static inline uint64_t bench_rand(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545f4914f6cdd1dULL;
+}
+
+static void bench_copy(uint8_t **p, uint8_t *end, const char *s, size_t n)
+{
+    if (n > (size_t)(end - *p))
+        n = end - *p;
+    memcpy(*p, s, n);
+    *p += n;
+}
+
+static void gen_random(uint8_t *buf, size_t len, uint64_t *seed)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = (uint8_t)(bench_rand(seed) >> 56);
+}
+
+static void gen_zeros(uint8_t *buf, size_t len, uint64_t *seed)
+{
+    (void)seed;
+    memset(buf, 0, len);
+}
+
+static const char *bench_words[] =
+{
+    "the", "of", "and", "to", "a", "in", "is", "that", "for", "it", "as",
+    "was", "with", "be", "by", "on", "not", "he", "this", "are", "or", "his",
+    "from", "at", "which", "but", "have", "an", "had", "they", "you", "were",
+    "their", "one", "all", "we", "can", "her", "has", "there", "been", "if",
+    "more", "when", "will", "would", "who", "so", "no", "dictionary", "code",
+    "table", "stream", "compression", "between", "without", "another",
+    "probably", "something", "example", "different", "through", "however",
+    "information"
+};
+#define BENCH_WORDS  (sizeof(bench_words) / sizeof(bench_words[0]))
+
+/* parole con distribuzione sbilanciata verso le più comuni */
+static void gen_text(uint8_t *buf, size_t len, uint64_t *seed)
+{
+    uint8_t *p = buf, *end = buf + len;
+    uint32_t n = 0;
+    uint64_t r;
+    const char *w;
+
+    while (p < end)
+    {
+        r = bench_rand(seed);
+        w = bench_words[(r % BENCH_WORDS) * ((r >> 16) % BENCH_WORDS) / BENCH_WORDS];
+        bench_copy(&p, end, w, strlen(w));
+
+        if (++n >= 6 + (r >> 32) % 12)
+        {
+            bench_copy(&p, end, (r >> 40) % 5 ? ". " : ".\n", 2);
+            n = 0;
+        }
+        else
+            bench_copy(&p, end, (r >> 48) % 9 ? " " : ", ", (r >> 48) % 9 ? 1 : 2);
+    }
+}
+
+static const char *bench_levels[]   = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+static const char *bench_services[] = { "sshd", "nginx", "kernel", "cron", "postgres", "dataroller" };
+static const char *bench_messages[] =
+{
+    "connection accepted", "request completed", "cache miss", "retrying operation",
+    "session closed", "checkpoint complete", "timeout waiting for peer",
+    "configuration reloaded"
+};
+
+/* righe di log con timestamp crescenti e pochi campi variabili */
+static void gen_log(uint8_t *buf, size_t len, uint64_t *seed)
+{
+    uint8_t *p = buf, *end = buf + len;
+    uint64_t r, ms = 0;
+    char line[160];
+    int n;
+
+    while (p < end)
+    {
+        r = bench_rand(seed);
+        ms += r % 250;
+        n = snprintf(line, sizeof(line),
+                     "2016-03-%02u %02u:%02u:%02u.%03u host%02u %s[%u]: %s %s id=%08x latency=%ums\n",
+                     (unsigned)(1 + (ms / 86400000) % 28), (unsigned)((ms / 3600000) % 24),
+                     (unsigned)((ms / 60000) % 60), (unsigned)((ms / 1000) % 60),
+                     (unsigned)(ms % 1000), (unsigned)((r >> 8) % 16),
+                     bench_services[(r >> 12) % 6], (unsigned)(1000 + (r >> 16) % 64),
+                     bench_levels[(r >> 24) % 6], bench_messages[(r >> 28) % 8],
+                     (unsigned)(r >> 32), (unsigned)((r >> 20) % 500));
+        bench_copy(&p, end, line, n);
+    }
+}
+
+/* record a 32 byte little endian: id, timestamp, quattro valori a
+   passeggiata casuale, tipo e padding a zero */
+static void gen_binary(uint8_t *buf, size_t len, uint64_t *seed)
+{
+    uint8_t rec[32], *p = buf, *end = buf + len;
+    uint32_t id = 0, ts = 1457000000;
+    int16_t val[4] = {0, 0, 0, 0};
+    uint64_t r;
+    int i;
+
+    memset(rec, 0, sizeof(rec));
+    while (p < end)
+    {
+        r = bench_rand(seed);
+        ts += r % 4;
+        for (i = 0; i < 4; i++)
+            val[i] += (int16_t)((r >> (8 + 8 * i)) % 7) - 3;
+
+        rec[0] = id; rec[1] = id >> 8; rec[2] = id >> 16; rec[3] = id >> 24;
+        rec[4] = ts; rec[5] = ts >> 8; rec[6] = ts >> 16; rec[7] = ts >> 24;
+        for (i = 0; i < 4; i++)
+        {
+            rec[8 + 2 * i] = (uint16_t)val[i];
+            rec[9 + 2 * i] = (uint16_t)val[i] >> 8;
+        }
+        rec[16] = (r >> 60) % 4;
+        id++;
+
+        bench_copy(&p, end, (const char *)rec, sizeof(rec));
+    }
+}
+
+static void gen_mixed(uint8_t *buf, size_t len, uint64_t *seed)
+{
+    static const bench_gen gens[] = { gen_text, gen_binary, gen_random, gen_log, gen_zeros };
+    size_t pos, n;
+    int i = 0;
+
+    for (pos = 0; pos < len; pos += n, i = (i + 1) % 5)
+    {
+        n = len - pos < BENCH_MIX_CHUNK ? len - pos : BENCH_MIX_CHUNK;
+        gens[i](buf + pos, n, seed);
+    }
+}
+
+static const bench_corpus bench_corpora[] =
+{
+    { "random", gen_random },
+    { "zeros",  gen_zeros  },
+    { "text",   gen_text   },
+    { "log",    gen_log    },
+    { "binary", gen_binary },
+    { "mixed",  gen_mixed  },
+    { NULL,     NULL       }
+};
+
+/********* peak rss *********/
+/* su linux il picco (VmHWM) si azzera con clear_refs, altrimenti resta
+   il massimo del processo */
+static void bench_rss_reset(void)
+{
+    FILE *f;
+
+    if ((f = fopen("/proc/self/clear_refs", "w")))
+    {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+static long bench_rss_peak(void)
+{
+    struct rusage ru;
+    char line[128];
+    long kb = -1;
+    FILE *f;
+
+    if ((f = fopen("/proc/self/status", "r")))
+    {
+        while (fgets(line, sizeof(line), f))
+            if (sscanf(line, "VmHWM: %ld", &kb) == 1)
+                break;
+        fclose(f);
+    }
+
+    if (kb < 0 && !getrusage(RUSAGE_SELF, &ru))
+        kb = ru.ru_maxrss;
+    return kb;
+}
+
+/********* run *********/
+static void bench_stats(const double *v, uint32_t n, double *mean, double *dev)
+{
+    double sum = 0, sq = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+        sum += v[i];
+    *mean = sum / n;
+
+    for (i = 0; i < n; i++)
+        sq += (v[i] - *mean) * (v[i] - *mean);
+    *dev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+}
+
+static double bench_mbps(size_t len, timer *tm)
+{
+    double sec = timer_diff(tm);
+
+    /* sotto la risoluzione del timer */
+    if (sec < 1e-6)
+        sec = 1e-6;
+    return len / 1e6 / sec;
+}
+
+static int bench_run(bench_result *res, const uint8_t *src, size_t len,
+                     uint8_t *dst, size_t dst_size, uint8_t *out,
+                     uint8_t level, uint32_t repeat)
+{
+    double *comp, *decomp;
+    size_t dst_len = 0, out_len;
+    uint32_t i;
+    timer tm;
+    int ret = -1;
+
+    comp = my_malloc(sizeof(double) * repeat);
+    decomp = my_malloc(sizeof(double) * repeat);
+
+    bench_rss_reset();
+    for (i = 0; i < repeat; i++)
+    {
+        dst_len = dst_size;
+        timer_start(&tm);
+        if (compress_lzw_mem(src, len, dst, &dst_len, level) != 0)
+        {
+            perror("compress");
+            goto abort_bench_run;
+        }
+        timer_stop(&tm);
+        comp[i] = bench_mbps(len, &tm);
+
+        out_len = len;
+        timer_start(&tm);
+        if (decompress_lzw_mem(dst, dst_len, out, &out_len) != 0)
+        {
+            perror("decompress");
+            goto abort_bench_run;
+        }
+        timer_stop(&tm);
+        decomp[i] = bench_mbps(len, &tm);
+
+        if (out_len != len || memcmp(src, out, len))
+        {
+            fprintf(stderr, "bench: %s level %u: roundtrip mismatch\n",
+                    res->corpus, level);
+            goto abort_bench_run;
+        }
+    }
+
+    res->level = level;
+    res->in_len = len;
+    res->out_len = dst_len;
+    res->rss_kb = bench_rss_peak();
+    bench_stats(comp, repeat, &res->comp_mean, &res->comp_dev);
+    bench_stats(decomp, repeat, &res->decomp_mean, &res->decomp_dev);
+    ret = 0;
+
+    abort_bench_run:
+        free(comp);
+        free(decomp);
+        return ret;
+}
+
+/********* output *********/
+static void bench_print_head(FILE *f, int format, size_t size, uint32_t repeat, uint64_t seed)
+{
+    const char *dict;
+
+    #ifdef USE_TRIE
+    dict = "trie";
+    #elif defined(USE_PACKED_HASH)
+    dict = "hash (packed)";
+    #else
+    dict = "hash (split)";
+    #endif
+
+    if (format == BENCH_CSV)
+        fprintf(f, "corpus,level,input_bytes,output_bytes,compression_ratio,"
+                   "compress_mbps,compress_mbps_stddev,decompress_mbps,"
+                   "decompress_mbps_stddev,peak_rss_kb\n");
+    else
+        fprintf(f, "{\n  \"version\": \"%s\",\n  \"dictionary\": \"%s\",\n"
+                   "  \"size\": %zu,\n  \"repeat\": %u,\n  \"seed\": %" PRIu64 ",\n"
+                   "  \"results\": [",
+                PACKAGE_VERSION, dict, size, repeat, seed);
+}
+
+static void bench_print(FILE *f, int format, const bench_result *r, bool first)
+{
+    double cr = r->out_len ? (double)r->in_len / r->out_len : 0;
+
+    if (format == BENCH_CSV)
+        fprintf(f, "%s,%u,%zu,%zu,%.4f,%.2f,%.2f,%.2f,%.2f,%ld\n",
+                r->corpus, r->level, r->in_len, r->out_len, cr,
+                r->comp_mean, r->comp_dev, r->decomp_mean, r->decomp_dev,
+                r->rss_kb);
+    else
+        fprintf(f, "%s\n    {\"corpus\": \"%s\", \"level\": %u, "
+                   "\"input_bytes\": %zu, \"output_bytes\": %zu, "
+                   "\"compression_ratio\": %.4f, "
+                   "\"compress_mbps\": %.2f, \"compress_mbps_stddev\": %.2f, "
+                   "\"decompress_mbps\": %.2f, \"decompress_mbps_stddev\": %.2f, "
+                   "\"peak_rss_kb\": %ld}",
+                first ? "" : ",", r->corpus, r->level, r->in_len, r->out_len,
+                cr, r->comp_mean, r->comp_dev, r->decomp_mean, r->decomp_dev,
+                r->rss_kb);
+    fflush(f);
+}
+
+static void bench_print_tail(FILE *f, int format)
+{
+    if (format == BENCH_JSON)
+        fprintf(f, "\n  ]\n}\n");
+}
+
+/********* options *********/
+static int bench_usage(void)
+{
+    fprintf(stderr, "\n"
+    "usage: %s bench [options]\n"
+    " -r, --ratio       <list>   : levels to sweep, e.g. 0-14 (default), 4,10\n"
+    " -n, --repeat      <n>      : repetitions per level (default %u)\n"
+    " -s, --size        <bytes>  : bytes per corpus, K/M/G suffixes (default 16M)\n"
+    " -C, --corpus      <list>   : random,zeros,text,log,binary,mixed (default all)\n"
+    "     --seed        <n>      : seed of the corpora generator\n"
+    "     --format      <fmt>    : json (default) or csv\n"
+    " -o, --output      <file>   : write results to file instead of stdout\n"
+    "\n"
+    "speeds are in MB/s (10^6 bytes of uncompressed data per second),\n"
+    "peak_rss_kb is the process resident peak during the runs of a level\n",
+    PACKAGE_NAME, BENCH_REPEAT);
+    return 1;
+}
+
+/* "0-14", "4,10" o combinazioni, bit i per il livello i */
+static int bench_parse_levels(const char *s, uint32_t *mask)
+{
+    char *end;
+    unsigned long a, b;
+
+    *mask = 0;
+    while (*s)
+    {
+        a = strtoul(s, &end, 10);
+        if (end == s)
+            return -1;
+        b = a;
+        if (*end == '-')
+        {
+            s = end + 1;
+            b = strtoul(s, &end, 10);
+            if (end == s)
+                return -1;
+        }
+        if (a > b || b >= BENCH_LEVELS)
+            return -1;
+        for (; a <= b; a++)
+            *mask |= 1u << a;
+
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return -1;
+        s = end;
+    }
+    return *mask ? 0 : -1;
+}
+
+static int bench_parse_size(const char *s, size_t *size)
+{
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+
+    switch (*end)
+    {
+        case 'k': case 'K': n <<= 10; end++; break;
+        case 'm': case 'M': n <<= 20; end++; break;
+        case 'g': case 'G': n <<= 30; end++; break;
+        default: break;
+    }
+    if (end == s || *end || !n || n > BENCH_SIZE_MAX)
+        return -1;
+    *size = n;
+    return 0;
+}
+
+/* bit i per il corpus i di bench_corpora */
+static int bench_parse_corpora(const char *s, uint32_t *mask)
+{
+    size_t n;
+    int i;
+
+    *mask = 0;
+    while (*s)
+    {
+        n = strcspn(s, ",");
+        for (i = 0; bench_corpora[i].name; i++)
+            if (strlen(bench_corpora[i].name) == n && !strncmp(bench_corpora[i].name, s, n))
+                break;
+        if (!bench_corpora[i].name)
+            return -1;
+        *mask |= 1u << i;
+        s += n + (s[n] == ',');
+    }
+    return *mask ? 0 : -1;
+}
+
+int bench_main(int argc, char **argv)
+{
+    int opt, i, format = BENCH_JSON;
+    uint32_t levels = (1u << BENCH_LEVELS) - 1, corpora = ~0u;
+    uint32_t repeat = BENCH_REPEAT;
+    uint64_t seed = BENCH_SEED, state;
+    size_t size = BENCH_SIZE, dst_size = 0;
+    uint8_t *src = NULL, *dst = NULL, *out = NULL, level;
+    FILE *f = stdout;
+    bench_result res;
+    bool first = true;
+    int ret = 1;
+
+    while (1)
+    {
+        static struct option long_options[] =
+        {
+            {"help",    no_argument,       0, 'h'},
+            {"ratio",   required_argument, 0, 'r'},
+            {"repeat",  required_argument, 0, 'n'},
+            {"size",    required_argument, 0, 's'},
+            {"corpus",  required_argument, 0, 'C'},
+            {"seed",    required_argument, 0, 'S'},
+            {"format",  required_argument, 0, 'F'},
+            {"output",  required_argument, 0, 'o'},
+            {0, 0, 0, 0}
+        };
+
+        opt = getopt_long(argc, argv, "hr:n:s:C:o:", long_options, NULL);
+        if (opt == -1)
+            break;
+
+        switch (opt)
+        {
+            case 'r':
+                if (bench_parse_levels(optarg, &levels) != 0)
+                {
+                    fprintf(stderr, "wrong ratio list: %s\n", optarg);
+                    return bench_usage();
+                }
+            break;
+
+            case 'n':
+                repeat = atoi(optarg);
+                if (!repeat)
+                    return bench_usage();
+            break;
+
+            case 's':
+                if (bench_parse_size(optarg, &size) != 0)
+                {
+                    fprintf(stderr, "wrong size: %s\n", optarg);
+                    return bench_usage();
+                }
+            break;
+
+            case 'C':
+                if (bench_parse_corpora(optarg, &corpora) != 0)
+                {
+                    fprintf(stderr, "unknown corpus in: %s\n", optarg);
+                    return bench_usage();
+                }
+            break;
+
+            case 'S':
+                seed = strtoull(optarg, NULL, 0);
+            break;
+
+            case 'F':
+                if (!strcmp(optarg, "csv"))
+                    format = BENCH_CSV;
+                else if (!strcmp(optarg, "json"))
+                    format = BENCH_JSON;
+                else
+                    return bench_usage();
+            break;
+
+            case 'o':
+                if (!(f = fopen(optarg, "w")))
+                {
+                    perror(optarg);
+                    return 1;
+                }
+            break;
+
+            default:
+                return bench_usage();
+        }
+    }
+
+    for (level = 0; level < BENCH_LEVELS; level++)
+        if (levels & (1u << level))
+            if (compress_lzw_bound(size, level) > dst_size)
+                dst_size = compress_lzw_bound(size, level);
+
+    src = my_malloc(size);
+    dst = my_malloc(dst_size);
+    out = my_malloc(size);
+    /* pagine già residenti, il picco misura il codec */
+    memset(dst, 0, dst_size);
+    memset(out, 0, size);
+
+    bench_print_head(f, format, size, repeat, seed);
+
+    for (i = 0; bench_corpora[i].name; i++)
+    {
+        if (!(corpora & (1u << i)))
+            continue;
+
+        /* stesso seme per ogni corpus, indipendente dalla selezione */
+        state = seed + i + 1;
+        bench_corpora[i].gen(src, size, &state);
+        res.corpus = bench_corpora[i].name;
+
+        for (level = 0; level < BENCH_LEVELS; level++)
+        {
+            if (!(levels & (1u << level)))
+                continue;
+
+            fprintf(stderr, "bench: %-6s level %2u\r", res.corpus, level);
+            if (bench_run(&res, src, size, dst, dst_size, out, level, repeat) != 0)
+                goto abort_bench;
+
+            bench_print(f, format, &res, first);
+            first = false;
+        }
+    }
+    fprintf(stderr, "%-24s\r", "");
+    ret = 0;
+
+    abort_bench:
+        bench_print_tail(f, format);
+        if (f != stdout)
+            fclose(f);
+        free(src);
+        free(dst);
+        free(out);
+        return ret;
+}
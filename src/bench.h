@@ -0,0 +1,8 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/* "dataroller bench [options]": in-memory roundtrips of synthetic corpora
+   over the compression levels, results as JSON or CSV */
+int bench_main(int, char **);
+
+#endif
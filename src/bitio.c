@@ -1,4 +1,6 @@
 #include "bitio.h"
+#include "iothread.h"
+#include "phase.h"
 #include "shared.h"
 
 #ifdef __linux__               /* endian conversions */
@@ -21,7 +23,7 @@
 #define HTOLE htole64
 #define LETOH le64toh
 
-static uint64_t lmask[65] = 
+static const uint64_t lmask[65] = 
 {
      0UL,
      0x1UL, 0x3UL, 0x7UL, 0xfUL,
@@ -42,34 +44,21 @@ static uint64_t lmask[65] =
      0x1fffffffffffffffUL, 0x3fffffffffffffffUL, 0x7fffffffffffffffUL, 0xffffffffffffffffUL
 };
 
-static uint64_t hmask[65] = 
-{
-    0UL,
-    0x8000000000000000UL, 0xc000000000000000UL, 0xe000000000000000UL, 0xf000000000000000UL,
-    0xf800000000000000UL, 0xfc00000000000000UL, 0xfe00000000000000UL, 0xff00000000000000UL,
-    0xff80000000000000UL, 0xffc0000000000000UL, 0xffe0000000000000UL, 0xfff0000000000000UL,
-    0xfff8000000000000UL, 0xfffc000000000000UL, 0xfffe000000000000UL, 0xffff000000000000UL,
-    0xffff800000000000UL, 0xffffc00000000000UL, 0xffffe00000000000UL, 0xfffff00000000000UL,
-    0xfffff80000000000UL, 0xfffffc0000000000UL, 0xfffffe0000000000UL, 0xffffff0000000000UL,
-    0xffffff8000000000UL, 0xffffffc000000000UL, 0xffffffe000000000UL, 0xfffffff000000000UL,
-    0xfffffff800000000UL, 0xfffffffc00000000UL, 0xfffffffe00000000UL, 0xffffffff00000000UL,
-    0xffffffff80000000UL, 0xffffffffc0000000UL, 0xffffffffe0000000UL, 0xfffffffff0000000UL,
-    0xfffffffff8000000UL, 0xfffffffffc000000UL, 0xfffffffffe000000UL, 0xffffffffff000000UL,
-    0xffffffffff800000UL, 0xffffffffffc00000UL, 0xffffffffffe00000UL, 0xfffffffffff00000UL,
-    0xfffffffffff80000UL, 0xfffffffffffc0000UL, 0xfffffffffffe0000UL, 0xffffffffffff0000UL,
-    0xffffffffffff8000UL, 0xffffffffffffc000UL, 0xffffffffffffe000UL, 0xfffffffffffff000UL,
-    0xfffffffffffff800UL, 0xfffffffffffffc00UL, 0xfffffffffffffe00UL, 0xffffffffffffff00UL,
-    0xffffffffffffff80UL, 0xffffffffffffffc0UL, 0xffffffffffffffe0UL, 0xfffffffffffffff0UL,
-    0xfffffffffffffff8UL, 0xfffffffffffffffcUL, 0xfffffffffffffffeUL, 0xffffffffffffffffUL     
-};
-
 struct bitio
 {
-    int fd;
+    int fd;                    /* -1 for memory streams */
     mode_t mode;
-    uint32_t pos;
+    uint32_t pos;              /* bits read, or whole words written */
     int len;
-    uint64_t buf[N_BLOCKS];
+    uint64_t acc;              /* write: bits of the next word, msb first */
+    uint32_t acc_bits;
+    uint8_t *mem;              /* memory stream area */
+    size_t   mem_pos, mem_size;
+    bool     mem_fixed;        /* caller area, it doesn't grow */
+    bool     mem_overflow;
+    size_t   mem_cap;          /* read area filled by bitio_mem_append */
+    struct iothread *io;       /* reads or writes of fd on a thread */
+    uint64_t buf[N_BLOCKS + 1]; /* + padding word for bitio_rd_peek */
 };
 
 void safe_close(int fd)
@@ -87,6 +76,7 @@ void safe_close(int fd)
 size_t safe_read(int fd, uint8_t *buf, size_t count) /* count is in byte, therefore buf is uint8_t* */
 {
     size_t done = 0, ret;
+    int phase = phase_switch(PHASE_INPUT);
 
     while (done != count)
     {
@@ -107,12 +97,14 @@ size_t safe_read(int fd, uint8_t *buf, size_t count) /* count is in byte, theref
         exit(1);
     }
 
+    phase_switch(phase);
     return done;
 }
 
 void safe_write(int fd, const uint8_t *buf, size_t count) /* count is in byte, therefore buf is uint8_t* */
 {
     size_t done = 0, ret;
+    int phase = phase_switch(PHASE_OUTPUT);
 
     while (done != count)
     {
@@ -129,6 +121,124 @@ void safe_write(int fd, const uint8_t *buf, size_t count) /* count is in byte, t
 
        exit(1);
     }
+
+    phase_switch(phase);
+}
+
+size_t safe_pread(int fd, uint8_t *buf, size_t count, off_t offset)
+{
+    size_t done = 0;
+    ssize_t ret;
+    int phase = phase_switch(PHASE_INPUT);
+
+    while (done != count)
+    {
+        if ((ret = pread(fd, buf, count-done, offset)) >= 0)
+        {
+            if (!ret)
+                break;
+
+            done   += ret;
+            buf    += ret;
+            offset += ret;
+            continue;
+        }
+
+        perror("pread()");
+        if (errno == EINTR)
+            continue;
+
+        exit(1);
+    }
+
+    phase_switch(phase);
+    return done;
+}
+
+void safe_pwrite(int fd, const uint8_t *buf, size_t count, off_t offset)
+{
+    size_t done = 0;
+    ssize_t ret;
+    int phase = phase_switch(PHASE_OUTPUT);
+
+    while (done != count)
+    {
+        if ((ret = pwrite(fd, buf, count-done, offset)) > 0)
+        {
+            done   += ret;
+            buf    += ret;
+            offset += ret;
+            continue;
+        }
+
+        perror("pwrite()");
+        if (errno == EINTR)
+            continue;
+
+        exit(1);
+    }
+
+    phase_switch(phase);
+}
+
+/* write count bytes of the buffer to the file or append them to the memory area */
+static void bitio_output(struct bitio *p, const uint8_t *buf, size_t count)
+{
+    if (p->io)
+    {
+        iothread_write(p->io, buf, count);
+        return;
+    }
+
+    if (p->fd >= 0)
+    {
+        safe_write(p->fd, buf, count);
+        return;
+    }
+
+    if (p->mem_fixed && p->mem_pos + count > p->mem_size)
+    {
+        p->mem_overflow = true;
+        return;
+    }
+
+    if (p->mem_pos + count > p->mem_size)
+    {
+        size_t size = p->mem_size ? p->mem_size : BUFFER_BYTE_SIZE;
+        uint8_t *mem;
+
+        while (p->mem_pos + count > size)
+            size <<= 1;
+
+        if (!(mem = realloc(p->mem, size)))
+        {
+            perror("realloc");
+            exit(1);
+        }
+        p->mem = mem;
+        p->mem_size = size;
+    }
+
+    memcpy(p->mem + p->mem_pos, buf, count);
+    p->mem_pos += count;
+}
+
+/* read up to count bytes from the file or from the memory area */
+static size_t bitio_input(struct bitio *p, uint8_t *buf, size_t count)
+{
+    if (p->io)
+        return iothread_read(p->io, buf, count);
+
+    if (p->fd >= 0)
+        return safe_read(p->fd, buf, count);
+
+    /* only whole words, a partial one may still be appended */
+    if (count > ((p->mem_size - p->mem_pos) & ~(size_t)7))
+        count = (p->mem_size - p->mem_pos) & ~(size_t)7;
+    memcpy(buf, p->mem + p->mem_pos, count);
+    p->mem_pos += count;
+
+    return count;
 }
 
 struct bitio *bitio_open(const char *filename, mode_t mode)
@@ -149,9 +259,24 @@ struct bitio *bitio_open(const char *filename, mode_t mode)
                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0)
         return (void*) NULL;
 
+    if (!(p = bitio_fdopen(fd, mode)))
+        safe_close(fd);
+
+    return p;
+}
+
+struct bitio *bitio_fdopen(int fd, mode_t mode)
+{
+    struct bitio *p;
+
+    if (fd < 0 || (mode != O_RDONLY && mode != O_WRONLY))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
     if (!(p = calloc(1, sizeof(struct bitio))))
     {
-        safe_close(fd);
         errno = ENOMEM;
         return NULL;
     }
@@ -161,148 +286,294 @@ struct bitio *bitio_open(const char *filename, mode_t mode)
     return p;
 }
 
-int bitio_close(struct bitio *p)
+struct bitio *bitio_open_mem(uint8_t *mem, size_t size, mode_t mode)
 {
-    uint32_t res;
+    struct bitio *p;
 
-    assert(p);
-    
-    res = p->pos/64 + ((p->pos & BLOCK_BIT_SIZE_SHIFT_MOD)?1:0);
-    if (res && p->mode != O_RDONLY)
+    if ((mode != O_RDONLY && mode != O_WRONLY) ||
+        (mode == O_RDONLY && size && !mem))
     {
-        for (int i = 0; i < res; i++)
-            p->buf[i] = HTOLE(p->buf[i]);
-        safe_write(p->fd, (uint8_t*)p->buf, res*8); /* flushing buffer */
+        errno = EINVAL;
+        return NULL;
     }
 
-    safe_close(p->fd);
-    memset(p, 0, sizeof(struct bitio));
-    free(p);
+    if (!(p = calloc(1, sizeof(struct bitio))))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
 
-    return 0;
+    p->fd = -1;
+    p->mode = mode;
+    if (mode == O_RDONLY || mem)
+    {
+        p->mem = mem;
+        p->mem_size = size;
+        p->mem_fixed = (mode == O_WRONLY);
+    }
+    return p;
 }
 
-static inline void bitio_check_flush(struct bitio *p)
+/* write the last (partial) words of the buffer */
+void bitio_flush(struct bitio *p)
 {
-    if (p->pos == N_BLOCKS*64)
+    if (p->mode != O_RDONLY)
     {
-        for (uint32_t i = 0; i < N_BLOCKS; i++)
-            p->buf[i] = HTOLE(p->buf[i]);
-        safe_write(p->fd, (uint8_t*)p->buf, N_BLOCKS*8);
-        p->pos = 0;
+        if (p->acc_bits)
+            p->buf[p->pos++] = HTOLE(p->acc);
+        if (p->pos)
+            bitio_output(p, (uint8_t*)p->buf, p->pos*8); /* flushing buffer */
+        p->acc = 0;
+        p->acc_bits = 0;
     }
+    p->pos = 0;
 }
 
-int bitio_read(struct bitio *p, uint64_t *data, uint8_t len)
+uint8_t *bitio_close_mem(struct bitio *p, size_t *size)
 {
-    uint8_t res, k;
-    uint32_t ofs;
-
-    assert(p && data);
-    assert(0 < len && len < 65);
+    uint8_t *mem = NULL;
 
-    *data &= 0;
+    assert(p && p->fd < 0);
 
-    while (len > 0)
+    if (p->mode != O_RDONLY)
     {
-        if (p->pos == p->len*8)
+        bitio_flush(p);
+        mem = p->mem;
+        if (size)
+            *size = p->mem_pos;
+        if (p->mem_overflow)
         {
-            p->len = safe_read(p->fd, (uint8_t*)p->buf, N_BLOCKS*8);
-            if (!p->len) // end of file
-                return 1;
-
-            if (p->len % 8) /* p->len must be multiple of block */
-                return -1;
-            for (uint32_t i = 0; i < p->len/8; i++)
-                p->buf[i] = LETOH(p->buf[i]);
-            p->pos = 0;
+            errno = ENOSPC;
+            mem = NULL;
         }
+    }
 
-        ofs = p->pos / 64;
-        k = (uint8_t)(p->pos & BLOCK_BIT_SIZE_SHIFT_MOD);
-        res = 64 - k;     
+    memset(p, 0, sizeof(struct bitio));
+    free(p);
 
-        if (len >= res)
-        {
-            len -= res;
-            *data |= (p->buf[ofs] & lmask[res]) << len;
-            p->pos += (uint32_t)res;
-        }
-        else
-        {
-            res -= len;
-            *data |= (p->buf[ofs] >> res) & lmask[len];
-            p->pos += (uint32_t)len;
-            return 0;
-        }
+    return mem;
+}
+
+int bitio_close(struct bitio *p)
+{
+    uint8_t *mem;
+
+    assert(p);
+
+    if (p->fd < 0)
+    {
+        bool fixed = p->mem_fixed;
+
+        if (p->mode == O_RDONLY && p->mem_cap) /* appended input */
+            free(p->mem);
+
+        mem = bitio_close_mem(p, NULL);
+        if (!fixed)
+            free(mem);
+        return 0;
     }
 
+    bitio_flush(p);
+
+    if (p->io) /* chiude anche il fd */
+        iothread_close(p->io);
+    else
+        safe_close(p->fd);
+    memset(p, 0, sizeof(struct bitio));
+    free(p);
+
     return 0;
 }
 
-int bitio_write(struct bitio *p, uint64_t data, uint8_t len)
+int bitio_mem_append(struct bitio *p, const uint8_t *buf, size_t count)
 {
-    uint8_t res, k;
-    uint32_t ofs;
+    assert(p && p->fd < 0 && p->mode == O_RDONLY);
+    assert(p->mem_cap || !p->mem);   /* caller areas can't grow */
 
-    assert(p);
-    assert(0 < len && len < 65);
+    /* drop the bytes already read */
+    if (p->mem_pos)
+    {
+        memmove(p->mem, p->mem + p->mem_pos, p->mem_size - p->mem_pos);
+        p->mem_size -= p->mem_pos;
+        p->mem_pos = 0;
+    }
 
-    while (len > 0)
+    if (p->mem_size + count > p->mem_cap)
     {
-        ofs = p->pos / 64;
-        k = (uint8_t)(p->pos & BLOCK_BIT_SIZE_SHIFT_MOD);
-        res = 64 - k;
-        p->buf[ofs] &= hmask[k];
-        if (len >= res)
-        {
-            len -= res;
-            p->buf[ofs] |= (data >> len) & lmask[res];
-            p->pos += (uint32_t)res;
-        }
-        else
+        size_t cap = p->mem_cap ? p->mem_cap : BUFFER_BYTE_SIZE;
+        uint8_t *mem;
+
+        while (p->mem_size + count > cap)
+            cap <<= 1;
+
+        if (!(mem = realloc(p->mem, cap)))
         {
-            res -= len;
-            p->buf[ofs] |= (data & lmask[len]) << res;
-            p->pos += (uint32_t)len;
-            bitio_check_flush(p);
-            return 0;
+            errno = ENOMEM;
+            return -1;
         }
-        bitio_check_flush(p);
+        p->mem = mem;
+        p->mem_cap = cap;
     }
+
+    memcpy(p->mem + p->mem_size, buf, count);
+    p->mem_size += count;
+
     return 0;
 }
 
-int bitio_write1(struct bitio *p)
+size_t bitio_mem_drain(struct bitio *p, uint8_t *buf, size_t count)
 {
-    uint8_t res, k;
-    uint32_t ofs;
+    assert(p && p->fd < 0 && p->mode == O_WRONLY && !p->mem_fixed);
+
+    if (count > p->mem_pos)
+        count = p->mem_pos;
+
+    memcpy(buf, p->mem, count);
+    memmove(p->mem, p->mem + count, p->mem_pos - count);
+    p->mem_pos -= count;
+
+    return count;
+}
+
+size_t bitio_mem_pending(struct bitio *p)
+{
+    assert(p && p->fd < 0);
+    return p->mode == O_RDONLY ? p->mem_size - p->mem_pos : p->mem_pos;
+}
 
+uint64_t bitio_avail(struct bitio *p)
+{
+    assert(p && p->fd < 0 && p->mode == O_RDONLY);
+
+    return (uint64_t)p->len * 8 - p->pos +
+           (uint64_t)((p->mem_size - p->mem_pos) & ~(size_t)7) * 8;
+}
+
+int bitio_async(struct bitio *p)
+{
     assert(p);
-    
-    ofs = p->pos / 64;
-    k = (uint8_t)(p->pos & BLOCK_BIT_SIZE_SHIFT_MOD);
-    res = 64 - k;
-    p->buf[ofs] &= hmask[k];
-    p->buf[ofs] |= (uint64_t)1 << (--res);
-    p->pos++;
-
-    bitio_check_flush(p);  
+
+    if (p->fd < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!p->io && !(p->io = iothread_open(p->fd, p->mode, IOTHREAD_BUFFERS, IOTHREAD_BUFFER_SIZE)))
+        return -1;
+
     return 0;
 }
 
-int bitio_write0(struct bitio *p)
+int bitio_fd(struct bitio *p)
 {
-    uint8_t k;
-    uint32_t ofs;
+    assert(p);
+    return p->fd;
+}
+
+void bitio_rd_open(struct bitio *p, struct bitio_rd *r)
+{
+    assert(p && r && p->mode == O_RDONLY);
+
+    r->cur = p->buf + p->pos / 64;
+    r->end = p->buf + p->len / 8;
+    r->k   = p->pos & BLOCK_BIT_SIZE_SHIFT_MOD;
+    r->p   = p;
+}
+
+void bitio_rd_close(struct bitio_rd *r)
+{
+    assert(r && r->p);
+
+    r->p->pos = (uint32_t)(r->cur - r->p->buf) * 64 + r->k;
+    r->p->len = (int)(r->end - r->p->buf) * 8;
+}
+
+bool bitio_rd_refill(struct bitio_rd *r, uint8_t n)
+{
+    struct bitio *p = r->p;
+    size_t left = r->end - r->cur, got;
+
+    /* the partial word goes at the beginning, then whole words only */
+    memmove(p->buf, r->cur, left * 8);
+    got = bitio_input(p, (uint8_t*)(p->buf + left), (N_BLOCKS - left) * 8) / 8;
+    for (size_t i = left; i < left + got; i++)
+        p->buf[i] = LETOH(p->buf[i]);
+
+    p->buf[left + got] = 0;
+    r->cur = p->buf;
+    r->end = p->buf + left + got;
+
+    return bitio_rd_avail(r) >= n;
+}
+
+int bitio_read(struct bitio *p, uint64_t *data, uint8_t len)
+{
+    struct bitio_rd r;
+    int ret = 0;
+
+    assert(p && data);
+    assert(0 < len && len < 65);
+
+    bitio_rd_open(p, &r);
+    if (bitio_rd_fill(&r, len))
+    {
+        *data = bitio_rd_peek(&r, len);
+        bitio_rd_consume(&r, len);
+    }
+    else /* end of file */
+        ret = 1;
+    bitio_rd_close(&r);
+
+    return ret;
+}
+
+void bitio_wr_open(struct bitio *p, struct bitio_wr *w)
+{
+    assert(p && w && p->mode == O_WRONLY);
+
+    w->acc  = p->acc;
+    w->bits = p->acc_bits;
+    w->cur  = p->buf + p->pos;
+    w->end  = p->buf + N_BLOCKS;
+    w->p    = p;
+}
+
+void bitio_wr_close(struct bitio_wr *w)
+{
+    assert(w && w->p);
+
+    w->p->acc      = w->acc;
+    w->p->acc_bits = w->bits;
+    w->p->pos      = (uint32_t)(w->cur - w->p->buf);
+}
+
+void bitio_wr_spill(struct bitio_wr *w)
+{
+    bitio_output(w->p, (uint8_t*)w->p->buf, N_BLOCKS*8);
+    w->cur = w->p->buf;
+}
+
+int bitio_write(struct bitio *p, uint64_t data, uint8_t len)
+{
+    struct bitio_wr w;
 
     assert(p);
+    assert(0 < len && len < 65);
 
-    ofs = p->pos / 64;
-    k = (uint8_t)(p->pos & BLOCK_BIT_SIZE_SHIFT_MOD);
-    p->buf[ofs] &= hmask[k];
-    p->pos++;
+    bitio_wr_open(p, &w);
+    bitio_wr_put(&w, data & lmask[len], len);
+    bitio_wr_close(&w);
 
-    bitio_check_flush(p);
     return 0;
 }
+
+int bitio_write1(struct bitio *p)
+{
+    return bitio_write(p, 1, 1);
+}
+
+int bitio_write0(struct bitio *p)
+{
+    return bitio_write(p, 0, 1);
+}
@@ -3,6 +3,15 @@
 
 #include <fcntl.h>             /* mode_t */
 #include <stdint.h>            /* {u,}int{8,16,32,64}_t */
+#include <stdbool.h>
+#include <stddef.h>            /* size_t */
+#include <sys/types.h>         /* off_t */
+
+#ifdef __linux__               /* htole64 */
+  #include <endian.h>
+#else
+  #include <sys/endian.h>
+#endif
 
 /* opaque type used for stream buffering */
 struct bitio;
@@ -10,19 +19,159 @@ struct bitio;
 /* open stream buffer to the given file */
 struct bitio*  bitio_open(const char *filename, mode_t mode);
 
+/* open stream buffer on an already open fd (stdin, stdout, pipes...),
+   the fd is closed by bitio_close */
+struct bitio*  bitio_fdopen(int fd, mode_t mode);
+
+/* open stream buffer on a memory area: O_RDONLY reads size bytes from mem,
+   O_WRONLY writes at most size bytes in mem, or collects the output in a
+   growing area when mem is NULL */
+struct bitio*  bitio_open_mem(uint8_t *mem, size_t size, mode_t mode);
+
 /* close stream buffer flushing the buffer */
 int     bitio_close(struct bitio *p);
 
+/* close a memory stream flushing the buffer, in write mode returns the
+   output area (to be freed by the caller if it was growing) and its size in
+   bytes, NULL with errno ENOSPC if a caller area was too small */
+uint8_t* bitio_close_mem(struct bitio *p, size_t *size);
+
+/* write the last (partial) words of a write stream, no more writes after it */
+void    bitio_flush(struct bitio *p);
+
+/* memory read stream opened with mem NULL: append count bytes of input */
+int     bitio_mem_append(struct bitio *p, const uint8_t *buf, size_t count);
+
+/* memory write stream opened with mem NULL: move up to count bytes of the
+   flushed output in buf, returns the bytes moved */
+size_t  bitio_mem_drain(struct bitio *p, uint8_t *buf, size_t count);
+
+/* bytes in the memory area not read yet (read) or not drained yet (write) */
+size_t  bitio_mem_pending(struct bitio *p);
+
+/* bits that bitio_read can return from a memory read stream */
+uint64_t bitio_avail(struct bitio *p);
+
+/* move the reads (read ahead) or the writes of a file stream on an I/O
+   thread, see iothread.h; the fd offset is no longer the stream position */
+int     bitio_async(struct bitio *p);
+
+/* file descriptor of the stream (-1 for memory streams) */
+int     bitio_fd(struct bitio *p);
+
 /* read len bits from the buffer and write them on data */
 int     bitio_read(struct bitio *p, uint64_t *data, uint8_t len);
 
 /* write len bits from data and write them on the buffer */
 int     bitio_write(struct bitio *p, uint64_t data, uint8_t len);
 
+/* bit reader borrowed from a read stream for hot loops: fill makes n bits
+   available, peek returns the next n bits (1 <= n <= 64) without moving,
+   consume skips them. nothing else may read from the stream between
+   bitio_rd_open and bitio_rd_close */
+struct bitio_rd
+{
+    const uint64_t *cur, *end; /* host order words of the stream buffer */
+    uint32_t  k;               /* bits of *cur already consumed */
+    struct bitio *p;
+};
+
+void    bitio_rd_open(struct bitio *p, struct bitio_rd *r);
+void    bitio_rd_close(struct bitio_rd *r);
+
+/* read more input, false if n bits are still not available (end of file,
+   or end of the input appended so far on a memory stream) */
+bool    bitio_rd_refill(struct bitio_rd *r, uint8_t n);
+
+static inline uint64_t bitio_rd_avail(const struct bitio_rd *r)
+{
+    return (uint64_t)(r->end - r->cur) * 64 - r->k;
+}
+
+static inline bool bitio_rd_fill(struct bitio_rd *r, uint8_t n)
+{
+    return bitio_rd_avail(r) >= n || bitio_rd_refill(r, n);
+}
+
+/* the word after the last one is always readable */
+static inline uint64_t bitio_rd_peek(const struct bitio_rd *r, uint8_t n)
+{
+    uint64_t win = (r->cur[0] << r->k) | ((r->cur[1] >> 1) >> (63 - r->k));
+    return win >> (64 - n);
+}
+
+static inline void bitio_rd_consume(struct bitio_rd *r, uint8_t n)
+{
+    r->k += n;
+    r->cur += r->k >> 6;
+    r->k &= 63;
+}
+
+/* bits up to the next word of the stream: a word read after them holds
+   8 bytes of the stream in order once converted with htole64 */
+static inline uint8_t bitio_rd_pad(const struct bitio_rd *r)
+{
+    return (uint8_t)((64 - r->k) & 63);
+}
+
+/* bit writer borrowed from a write stream for hot loops: the accumulator and
+   the buffer pointers can live in registers, whole words are stored little
+   endian in the stream buffer. nothing else may write on the stream between
+   bitio_wr_open and bitio_wr_close */
+struct bitio_wr
+{
+    uint64_t  acc;             /* pending bits, msb first */
+    uint32_t  bits;            /* pending bits count, < 64 */
+    uint64_t *cur, *end;       /* next free word of the stream buffer */
+    struct bitio *p;
+};
+
+void    bitio_wr_open(struct bitio *p, struct bitio_wr *w);
+void    bitio_wr_close(struct bitio_wr *w);
+
+/* the stream buffer is full: write it out */
+void    bitio_wr_spill(struct bitio_wr *w);
+
+/* write the len low bits of data, the other bits of data must be zero */
+static inline void bitio_wr_put(struct bitio_wr *w, uint64_t data, uint8_t len)
+{
+    uint32_t space = 64 - w->bits;
+
+    if (len < space)
+    {
+        w->acc |= data << (space - len);
+        w->bits += len;
+        return;
+    }
+
+    len -= space;
+    *w->cur++ = htole64(w->acc | (data >> len));
+    w->acc = len ? data << (64 - len) : 0;
+    w->bits = len;
+
+    if (w->cur == w->end)
+        bitio_wr_spill(w);
+}
+
+/* zero bits up to the next word, then words put with le64toh of 8 bytes
+   land in the stream as those bytes */
+static inline void bitio_wr_align(struct bitio_wr *w)
+{
+    if (w->bits)
+        bitio_wr_put(w, 0, (uint8_t)(64 - w->bits));
+}
+
 /* write one bit to buffer, (simpler implementation) */
 int     bitio_write1(struct bitio *p);
 
 /* write zero bit to buffer, (simpler implementation) */
 int     bitio_write0(struct bitio *p);
 
+/* fd helpers, they retry on EINTR and exit on errors */
+void    safe_close(int fd);
+size_t  safe_read(int fd, uint8_t *buf, size_t count);
+void    safe_write(int fd, const uint8_t *buf, size_t count);
+size_t  safe_pread(int fd, uint8_t *buf, size_t count, off_t offset);
+void    safe_pwrite(int fd, const uint8_t *buf, size_t count, off_t offset);
+
 #endif /* _BITIO_H_ */
@@ -0,0 +1,36 @@
+#ifndef _BLOCK_LZW_H_
+#define _BLOCK_LZW_H_
+
+#include <stdint.h>
+
+/*
+ * multi-block container, every block is an independent LZW stream
+ * (codes + EOF code, padded to a 64 bit word) with no header of its own.
+ * the block table is also a seek index: every block starts with an empty
+ * dictionary and 9 bit codes, at the uncompressed offset given by the sum
+ * of the sizes of the blocks before it.
+ *
+ *  word 0 : HEADER_MAGIC_BLOCK (24) | code max bits (8) | table max (32)
+ *  word 1 : block size (32) | number of blocks (32)
+ *  word 2 : block table offset in bytes (64)
+ *  block table, two words per block:
+ *           compressed offset in bytes (64)
+ *           compressed size (32) | uncompressed size (32)
+ */
+
+#define HEADER_MAGIC_BLOCK  0x00425a4c /* ZBL */
+
+#define BLOCK_HEADER_SIZE   24         /* bytes */
+#define BLOCK_ENTRY_SIZE    16         /* bytes */
+#define BLOCK_DEFAULT_SIZE  (4 << 20)  /* 4 MiB */
+#define BLOCK_MIN_SIZE      (16 << 10) /* restart interval limits */
+#define BLOCK_MAX_SIZE      (256 << 20)
+
+typedef struct block_entry
+{
+    uint64_t offset;
+    uint32_t csize;
+    uint32_t usize;
+} block_entry;
+
+#endif
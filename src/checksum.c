@@ -0,0 +1,121 @@
+#include "checksum.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+  #include <arm_acle.h>
+#endif
+
+#define CRC32C_POLY  0x82f63b78  /* polinomio riflesso */
+
+typedef uint32_t (*crc32c_fn)(uint32_t, const uint8_t *, size_t);
+
+static uint32_t  crc32c_table[8][256];
+static crc32c_fn crc32c_impl;
+static const char *crc32c_name;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/* slicing-by-8: otto byte per giro con otto tabelle */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *buf, size_t count)
+{
+    uint32_t c = ~crc;
+
+    while (count >= 8)
+    {
+        c ^= buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+        c = crc32c_table[7][c & 0xff] ^ crc32c_table[6][(c >> 8) & 0xff] ^
+            crc32c_table[5][(c >> 16) & 0xff] ^ crc32c_table[4][c >> 24] ^
+            crc32c_table[3][buf[4]] ^ crc32c_table[2][buf[5]] ^
+            crc32c_table[1][buf[6]] ^ crc32c_table[0][buf[7]];
+        buf += 8;
+        count -= 8;
+    }
+    while (count--)
+        c = crc32c_table[0][(c ^ *buf++) & 0xff] ^ (c >> 8);
+
+    return ~c;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *buf, size_t count)
+{
+    uint64_t c = ~crc & 0xffffffff, w;
+
+    for (; count && ((uintptr_t)buf & 7); count--)
+        c = __builtin_ia32_crc32qi((uint32_t)c, *buf++);
+    for (; count >= 8; count -= 8, buf += 8)
+    {
+        memcpy(&w, buf, 8);
+        c = __builtin_ia32_crc32di(c, w);
+    }
+    for (; count; count--)
+        c = __builtin_ia32_crc32qi((uint32_t)c, *buf++);
+
+    return ~(uint32_t)c;
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_armv8(uint32_t crc, const uint8_t *buf, size_t count)
+{
+    uint32_t c = ~crc;
+    uint64_t w;
+
+    for (; count && ((uintptr_t)buf & 7); count--)
+        c = __crc32cb(c, *buf++);
+    for (; count >= 8; count -= 8, buf += 8)
+    {
+        memcpy(&w, buf, 8);
+        c = __crc32cd(c, w);
+    }
+    for (; count; count--)
+        c = __crc32cb(c, *buf++);
+
+    return ~c;
+}
+#endif
+
+static void crc32c_init(void)
+{
+    uint32_t i, j, c;
+
+    for (i = 0; i < 256; i++)
+    {
+        for (c = i, j = 0; j < 8; j++)
+            c = (c >> 1) ^ (CRC32C_POLY & -(c & 1));
+        crc32c_table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++)
+        for (j = 1; j < 8; j++)
+            crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^
+                                 crc32c_table[0][crc32c_table[j - 1][i] & 0xff];
+
+    crc32c_impl = crc32c_sw;
+    crc32c_name = "table";
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        crc32c_impl = crc32c_sse42;
+        crc32c_name = "sse4.2";
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    crc32c_impl = crc32c_armv8;
+    crc32c_name = "armv8";
+#endif
+}
+
+uint32_t checksum_crc32c(uint32_t crc, const uint8_t *buf, size_t count)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_impl(crc, buf, count);
+}
+
+const char *checksum_impl(void)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_name;
+}
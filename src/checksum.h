@@ -0,0 +1,15 @@
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* crc32c (castagnoli) of count bytes of buf, crc is the value of the bytes
+   before them (0 at the start). uses the crc32 instructions of sse4.2 or
+   armv8 when available, a slicing-by-8 table otherwise */
+uint32_t    checksum_crc32c(uint32_t crc, const uint8_t *buf, size_t count);
+
+/* implementation in use: "sse4.2", "armv8" or "table" */
+const char *checksum_impl(void);
+
+#endif
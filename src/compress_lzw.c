@@ -1,14 +1,26 @@
 #include "compress_lzw.h"
+#include "block_lzw.h"
 #include "bitio.h"
+#include "checksum.h"
+#include "iothread.h"
+#include "workqueue.h"
+#include "file.h"
+#include "phase.h"
+#include "table_alloc.h"
 #include "shared.h"
 
+#include <sys/stat.h>
+#include <inttypes.h>  /* PRIu64 */
+
 #define CODE_MIN_MAX_BITS  12
 #define CODE_MAX_MAX_BITS  26
 
 #define LZW_CODE_EMPTY    256
+#define LZW_CODE_CLEAR    256 /* solo in reset adattivo, a dizionario pieno */
 #define LZW_CODE_EOF      257
 #define LZW_CODE_START    258
 
+#ifndef USE_TRIE
 /* prime number bigger than ctx->code_max      */
 /* http://primes.utm.edu/lists/small/millions/ */
 static const uint32_t hash_sizes[15] = 
@@ -29,55 +41,446 @@ static const uint32_t hash_sizes[15] =
     35086279,     /* CODE_MAX_BITS == 25 min: 33554431*/
     68219119      /* CODE_MAX_BITS == 26 min: 67108863*/
 };
+#endif
 
 #define READ_BLOCK_SIZE  8192
+#define PUSH_CHUNK_SIZE  4096 /* input coded per giro, limita l'output in sospeso */
+
+/* reset adattivo: a dizionario pieno ogni ADAPTIVE_GAP byte di input si
+   misurano i bit per byte dall'ultimo reset, si manda un CLEAR appena
+   peggiorano (come il CLEAR di compress) o se arrivano ad ADAPTIVE_CAP */
+#define ADAPTIVE_GAP     16384
+#define ADAPTIVE_CAP     (8 << 8) /* il dizionario allunga l'input */
+
+/* segmenti memorizzati (LZW_FLAG_STORE): all'inizio di ogni segmento di
+   STORE_SEGMENT byte si stima l'entropia d'ordine 0 sui byte disponibili
+   (almeno STORE_PROBE_MIN), sopra STORE_ENTROPY bit per byte (<< 8) il
+   LZW allunga i dati ed il segmento si copia così com'è */
+#define STORE_SEGMENT    65536
+#define STORE_PROBE_MIN  4096
+#define STORE_ENTROPY    (15 << 7) /* 7.5 */
+
+/* corse di un byte ripetuto: con la catena c, cc, ccc... lunga almeno
+   RUN_MIN si salta al suo code più lungo senza cercare byte per byte */
+#define RUN_MIN          32
 
 #define HEADER_MAGIC     0x00575a4c /* ZWL */
 
+/* statistiche del dizionario (--enable-stats), senza USE_STATS le
+   istruzioni in STATS() spariscono */
+#ifdef USE_STATS
+#define STATS(x)         x
+#define STATS_PROBES_MAX 16 /* ultima classe: 16 probe o più */
+
+typedef struct lzw_stats
+{
+    uint64_t lookups, hits, probes;
+    uint64_t probe_hist[STATS_PROBES_MAX + 1];
+    uint64_t resets;
+    double   load_sum, load_min, load_max; /* fattore di carico ai reset */
+    uint64_t strings;                      /* codici di stringhe dell'input */
+    uint64_t width[CODE_MAX_MAX_BITS + 1]; /* codici scritti per lunghezza */
+    uint64_t stored;                       /* byte in segmenti memorizzati */
+} lzw_stats;
+#else
+#define STATS(x)
+#endif
+
+#if defined(USE_TRIE)
+/* nodo a 64 bit indicizzato dal code: primo figlio (o blocco denso),
+   fratello successivo, simbolo, numero di figli (saturato) e flag denso.
+   i nodi con molti figli passano ad un blocco denso di 256 code, i 256
+   caratteri usano sempre i primi 256 blocchi */
+#define TRIE_CODE_BITS   CODE_MAX_MAX_BITS
+#define TRIE_CODE_MASK   ((UINT64_C(1) << TRIE_CODE_BITS) - 1)
+#define TRIE_FANOUT_SHIFT 60
+#define TRIE_FANOUT_MAX  7
+#define TRIE_DENSE_FLAG  (UINT64_C(1) << 63)
+#define TRIE_CHILD(n)    ((uint32_t)((n) & TRIE_CODE_MASK))
+#define TRIE_SIBLING(n)  ((uint32_t)(((n) >> TRIE_CODE_BITS) & TRIE_CODE_MASK))
+#define TRIE_SYMBOL(n)   ((uint8_t)((n) >> (2 * TRIE_CODE_BITS)))
+#define TRIE_FANOUT(n)   ((uint32_t)((n) >> TRIE_FANOUT_SHIFT) & TRIE_FANOUT_MAX)
+#define TRIE_NODE(sibling, symbol) (((uint64_t)(sibling) << TRIE_CODE_BITS) | \
+                                    ((uint64_t)(symbol) << (2 * TRIE_CODE_BITS)))
+#define TRIE_DENSE_MAX   65536 /* blocchi densi oltre la radice, 1 KiB l'uno */
+#elif defined(USE_PACKED_HASH)
+/* entry a 64 bit: code nei 26 bit bassi, sopra la chiave (parent << 8 | symbol)
+   e nei 4 bit alti la generazione. una entry di una generazione diversa da
+   quella corrente è vuota, così il reset incrementa solo la generazione e
+   la tabella si svuota una volta ogni HASH_GEN_MAX reset */
+#define HASH_CODE_BITS   CODE_MAX_MAX_BITS
+#define HASH_CODE_MASK   ((UINT64_C(1) << HASH_CODE_BITS) - 1)
+#define HASH_GEN_SHIFT   (2 * HASH_CODE_BITS + 8)
+#define HASH_GEN_MAX     ((UINT64_C(1) << (64 - HASH_GEN_SHIFT)) - 1)
+#define HASH_KEY(parent, symbol) (((uint64_t)(parent) << 8) | (uint64_t)(symbol))
+#endif
+
+/* catena dei code di c, cc, ccc... nel dizionario corrente */
+typedef struct lzw_run
+{
+    uint32_t top;            /* code della stringa più lunga */
+    uint32_t len;
+    uint32_t gen;            /* diversa da run_gen: solo c, dopo un reset */
+} lzw_run;
+
 typedef struct lzw_context_enc
 {
+#if defined(USE_TRIE)
+    uint64_t* trie;          /* nodi, code 0 = nessun figlio o fratello */
+    uint32_t  trie_nodes;
+    uint32_t* trie_dense;    /* blocchi densi, [block << 8 | symbol] */
+    uint32_t  dense_used, dense_max;
+    uint32_t* root_gen;      /* generazione dei blocchi della radice */
+    uint32_t  gen;
+#elif defined(USE_PACKED_HASH)
+    uint64_t* table;         /* child, parent e symbol: un accesso per probe */
+    uint64_t  gen;           /* generazione corrente, 0 = mai scritta */
+#else
     /* si fanno separate per l'allineamento */
-    uint32_t* table_code;    /* child */ /* FIXME child e parent insieme per < località */
+    uint32_t* table_code;    /* child */
     uint32_t* table_parent;  /* parent */
     uint8_t*  table_symbol;
+#endif
 
     uint8_t  code_max_bits, hash_shift;
-    uint32_t code_max, hash_size, table_max;
+    uint32_t code_max, hash_size, table_max; /* table_max 0: mai */
+
+    bool     adaptive;       /* reset con LZW_CODE_CLEAR */
+    bool     checksum;       /* crc32c dell'input dopo il codice di EOF */
+    bool     plain;          /* codici a larghezza piena invece che troncati */
+    bool     store;          /* segmenti incomprimibili memorizzati */
+    bool     storing;        /* il segmento corrente è memorizzato */
+    uint32_t segment_left;   /* byte del segmento corrente, 0: se ne inizia uno */
+    uint32_t crc;            /* dell'input dello stream corrente */
+    uint64_t in_bytes;       /* input codificato prima della chiamata corrente */
+    uint64_t gap_reset;      /* input all'ultimo reset, senza i segmenti memorizzati */
+    uint64_t gap_check;      /* input all'ultimo controllo, UINT64_MAX: non pieno */
+    uint64_t gap_bits;       /* bit scritti dall'ultimo reset */
+    uint32_t gap_last;       /* bit per byte << 8 all'ultimo controllo */
+    lzw_run  runs[256];
+    uint32_t run_gen;
+    uint32_t run_pending;    /* parent c ripetuto run_pending volte, non ancora cercato */
 
     struct bitio *b_dst;
     FILE  *f_src;
+    struct iothread *io_src; /* f_src letto da un thread, LZW_FLAG_PIPELINE */
     uint32_t  current_parent_code;
     uint32_t  current_max_code;
     uint32_t  new_code;
     uint8_t   new_symbol;
     uint8_t   current_code_bits;
+#ifdef USE_STATS
+    lzw_stats stats;
+#endif
 } lzw_context_enc;
 
+#ifndef USE_TRIE
+/* bit della tabella: con reset a intervallo fisso basta quella di table_max */
+static inline uint8_t hash_bits(const lzw_context_enc *ctx)
+{
+    uint8_t bits = ctx->code_max_bits;
+
+    if (ctx->table_max)
+        while (bits > CODE_MIN_MAX_BITS && (1u << (bits - 1)) >= ctx->table_max)
+            bits--;
+    return bits;
+}
+#endif
+
+#ifdef USE_STATS
+static inline void lzw_stats_lookup(lzw_context_enc *ctx, uint32_t probes, int hit)
+{
+    ctx->stats.lookups++;
+    ctx->stats.hits += hit;
+    ctx->stats.probes += probes;
+    ctx->stats.probe_hist[probes < STATS_PROBES_MAX ? probes : STATS_PROBES_MAX]++;
+}
+
+/* code nel dizionario rispetto agli slot (nodi per il trie) */
+static double lzw_stats_load(lzw_context_enc *ctx)
+{
+#ifdef USE_TRIE
+    return (double)(ctx->new_code - LZW_CODE_START) / ctx->code_max;
+#else
+    return (double)(ctx->new_code - LZW_CODE_START) / ctx->hash_size;
+#endif
+}
+
+static void lzw_stats_reset(lzw_context_enc *ctx)
+{
+    double load = lzw_stats_load(ctx);
+
+    if (ctx->new_code <= LZW_CODE_START) /* già vuoto, o appena allocato */
+        return;
+
+    if (!ctx->stats.resets || load < ctx->stats.load_min)
+        ctx->stats.load_min = load;
+    if (load > ctx->stats.load_max)
+        ctx->stats.load_max = load;
+    ctx->stats.load_sum += load;
+    ctx->stats.resets++;
+}
+#endif
+
+/********* TRIE *********/
+#if defined(USE_TRIE)
+void trie_free(lzw_context_enc *ctx)
+{
+    assert(ctx);
+
+    table_free(ctx->trie, sizeof(uint64_t) * ctx->trie_nodes);
+    table_free(ctx->trie_dense, sizeof(uint32_t) * 256 * ctx->dense_max);
+    if (ctx->root_gen)
+        free(ctx->root_gen);
+}
+
+bool trie_init(lzw_context_enc *ctx)
+{
+    assert(ctx);
+
+    /* con reset a intervallo fisso bastano table_max nodi */
+    ctx->trie_nodes = ctx->code_max;
+    if (ctx->table_max && ctx->table_max < ctx->code_max)
+        ctx->trie_nodes = ctx->table_max + 1;
+
+    ctx->dense_max = ctx->trie_nodes >> 4;
+    if (ctx->dense_max > TRIE_DENSE_MAX)
+        ctx->dense_max = TRIE_DENSE_MAX;
+    ctx->dense_max += 256;
+
+    /* i nodi si inizializzano all'inserimento */
+    if (!(ctx->trie = table_alloc(sizeof(uint64_t) * ctx->trie_nodes)))
+        goto abort_new_trie_enc;
+    if (!(ctx->trie_dense = table_alloc(sizeof(uint32_t) * 256 * ctx->dense_max)))
+        goto abort_new_trie_enc;
+    if (!(ctx->root_gen = calloc(256, sizeof(uint32_t))))
+        goto abort_new_trie_enc;
+
+    return true;
+
+    abort_new_trie_enc:
+    trie_free(ctx);
+
+    return false;
+}
+
+/* i nodi vengono riscritti dai nuovi code, i blocchi della radice di una
+   generazione precedente sono vuoti e si svuotano al primo inserimento */
+void trie_reset(lzw_context_enc *ctx)
+{
+    assert(ctx);
+
+    if (!++ctx->gen) /* giro completo, i tag non distinguono più */
+    {
+        memset(ctx->root_gen, 0, sizeof(uint32_t) * 256);
+        ctx->gen = 1;
+    }
+    ctx->dense_used = 256;
+}
+
+int trie_lookup(lzw_context_enc *ctx, uint64_t* index)
+{
+    uint32_t code;
+    uint64_t node;
+    STATS(uint32_t probes = 1;)
+
+    if (ctx->current_parent_code < 256)
+        code = ctx->root_gen[ctx->current_parent_code] != ctx->gen ? 0 :
+               ctx->trie_dense[ctx->current_parent_code << 8 | ctx->new_symbol];
+    else if ((node = ctx->trie[ctx->current_parent_code]) & TRIE_DENSE_FLAG)
+        code = ctx->trie_dense[TRIE_CHILD(node) << 8 | ctx->new_symbol];
+    else
+    {
+        code = TRIE_CHILD(node);
+        while (code && TRIE_SYMBOL(ctx->trie[code]) != ctx->new_symbol)
+        {
+            STATS(probes++;)
+            code = TRIE_SIBLING(ctx->trie[code]);
+        }
+        STATS(probes += code != 0;)
+    }
+
+    STATS(lzw_stats_lookup(ctx, probes, code != 0);)
+    *index = code;
+    return code != 0;
+}
+
+/* sposta i figli di un nodo in un blocco denso libero */
+static void trie_make_dense(lzw_context_enc *ctx, uint64_t *parent)
+{
+    uint32_t code, block = ctx->dense_used++;
+    uint32_t *dense = ctx->trie_dense + ((size_t)block << 8);
+
+    memset(dense, 0, sizeof(uint32_t) * 256);
+    for (code = TRIE_CHILD(*parent); code; code = TRIE_SIBLING(ctx->trie[code]))
+        dense[TRIE_SYMBOL(ctx->trie[code])] = code;
+
+    *parent = (*parent & ~TRIE_CODE_MASK) | TRIE_DENSE_FLAG | block;
+}
+
+void trie_insert(lzw_context_enc *ctx, uint64_t index)
+{
+    uint64_t *parent;
+    uint32_t fanout;
+
+    (void)index;
+
+    ctx->trie[ctx->new_code] = TRIE_NODE(0, ctx->new_symbol);
+
+    if (ctx->current_parent_code < 256)
+    {
+        if (ctx->root_gen[ctx->current_parent_code] != ctx->gen)
+        {
+            memset(ctx->trie_dense + (ctx->current_parent_code << 8), 0, sizeof(uint32_t) * 256);
+            ctx->root_gen[ctx->current_parent_code] = ctx->gen;
+        }
+        ctx->trie_dense[ctx->current_parent_code << 8 | ctx->new_symbol] = ctx->new_code;
+        return;
+    }
+
+    parent = &ctx->trie[ctx->current_parent_code];
+    fanout = TRIE_FANOUT(*parent);
+
+    if (!(*parent & TRIE_DENSE_FLAG) && fanout == TRIE_FANOUT_MAX &&
+        ctx->dense_used < ctx->dense_max)
+        trie_make_dense(ctx, parent);
+
+    if (*parent & TRIE_DENSE_FLAG)
+        ctx->trie_dense[TRIE_CHILD(*parent) << 8 | ctx->new_symbol] = ctx->new_code;
+    else /* il nuovo code diventa il primo figlio */
+    {
+        ctx->trie[ctx->new_code] = TRIE_NODE(TRIE_CHILD(*parent), ctx->new_symbol);
+        *parent &= ~(TRIE_CODE_MASK | ((uint64_t)TRIE_FANOUT_MAX << TRIE_FANOUT_SHIFT));
+        *parent |= ctx->new_code | ((uint64_t)(fanout < TRIE_FANOUT_MAX ? fanout + 1 : fanout)
+                                    << TRIE_FANOUT_SHIFT);
+    }
+}
+
+static inline FORCE_INLINE uint32_t trie_code(lzw_context_enc *ctx, uint64_t index)
+{
+    (void)ctx;
+    return (uint32_t)index;
+}
+
+#define dict_init    trie_init
+#define dict_free    trie_free
+#define dict_reset   trie_reset
+#define dict_lookup  trie_lookup
+#define dict_insert  trie_insert
+#define dict_code    trie_code
+
 /********* HASH *********/
+#elif defined(USE_PACKED_HASH)
+void hash_free(lzw_context_enc *ctx)
+{
+    assert(ctx);
+
+    table_free(ctx->table, sizeof(uint64_t) * ctx->hash_size);
+}
+
+bool hash_init(lzw_context_enc *ctx)
+{
+    assert(ctx);
+
+    ctx->hash_size = hash_sizes[hash_bits(ctx) - CODE_MIN_MAX_BITS];
+    ctx->hash_shift = hash_bits(ctx) - 8;
+
+    /* allineata alla cache line, già a zero */
+    if (!(ctx->table = table_alloc(sizeof(uint64_t) * ctx->hash_size)))
+        return false;
+    ctx->gen = 0;
+
+    return true;
+}
+
+/* O(1), la tabella si svuota solo quando la generazione torna a capo */
+void hash_reset(lzw_context_enc *ctx)
+{
+    assert(ctx);
+
+    if (ctx->gen++ == HASH_GEN_MAX)
+    {
+        memset(ctx->table, 0, sizeof(uint64_t) * ctx->hash_size);
+        ctx->gen = 1;
+    }
+}
+
+static inline FORCE_INLINE uint32_t hash_code(lzw_context_enc *ctx, uint64_t index)
+{
+    return (uint32_t)(ctx->table[index] & HASH_CODE_MASK);
+}
+
+void hash_insert(lzw_context_enc *ctx, uint64_t index)
+{
+    assert(ctx && (ctx->table[index] >> HASH_GEN_SHIFT) != ctx->gen);
+
+    ctx->table[index] = (ctx->gen << HASH_GEN_SHIFT) |
+                        (HASH_KEY(ctx->current_parent_code, ctx->new_symbol) << HASH_CODE_BITS) |
+                        (uint64_t)ctx->new_code;
+}
+
+FORCE_INLINE void hash_function_xor(lzw_context_enc *ctx, uint64_t* index)
+{
+    *index = ((uint64_t)ctx->new_symbol << ctx->hash_shift) ^ (uint64_t)ctx->current_parent_code;
+}
+
+int hash_lookup(lzw_context_enc *ctx, uint64_t* index)
+{
+    uint32_t offset;
+    uint64_t entry;
+    /* chiave con la generazione, confrontata con entry >> HASH_CODE_BITS */
+    uint64_t key = (ctx->gen << (HASH_GEN_SHIFT - HASH_CODE_BITS)) |
+                   HASH_KEY(ctx->current_parent_code, ctx->new_symbol);
+    STATS(uint32_t probes = 0;)
+
+    hash_function_xor(ctx, index);
+    offset = (*index) ? ((uint32_t)ctx->hash_size - *index) : (uint32_t)1;
+
+    while (1)
+    {
+        entry = ctx->table[*index];
+        STATS(probes++;)
+
+        if ((entry >> HASH_GEN_SHIFT) != ctx->gen)
+        {
+            STATS(lzw_stats_lookup(ctx, probes, 0);)
+            return 0;
+        }
+
+        if ((entry >> HASH_CODE_BITS) == key)
+        {
+            STATS(lzw_stats_lookup(ctx, probes, 1);)
+            return 1;
+        }
+
+        if (*index < offset)
+            *index += (uint32_t)ctx->hash_size - offset;
+        else
+            *index -= offset;
+    }
+}
+#else
 void hash_free(lzw_context_enc *ctx)
 {
     assert(ctx);
 
-    if (ctx->table_code)
-        free(ctx->table_code);
-    if (ctx->table_parent)
-        free(ctx->table_parent);
-    if (ctx->table_symbol)
-        free(ctx->table_symbol);
+    table_free(ctx->table_code, sizeof(uint32_t) * ctx->hash_size);
+    table_free(ctx->table_parent, sizeof(uint32_t) * ctx->hash_size);
+    table_free(ctx->table_symbol, sizeof(uint8_t) * ctx->hash_size);
 }
 
 bool hash_init(lzw_context_enc *ctx)
 {
     assert(ctx);
 
-    ctx->hash_size = hash_sizes[ctx->code_max_bits - CODE_MIN_MAX_BITS];
-    ctx->hash_shift = ctx->code_max_bits - 8;
+    ctx->hash_size = hash_sizes[hash_bits(ctx) - CODE_MIN_MAX_BITS];
+    ctx->hash_shift = hash_bits(ctx) - 8;
 
-    if (!(ctx->table_code = calloc(1, sizeof(uint32_t) * ctx->hash_size)))
+    if (!(ctx->table_code = table_alloc(sizeof(uint32_t) * ctx->hash_size)))
         goto abort_new_hash_enc;
-    if (!(ctx->table_parent = calloc(1, sizeof(uint32_t) * ctx->hash_size)))
+    if (!(ctx->table_parent = table_alloc(sizeof(uint32_t) * ctx->hash_size)))
         goto abort_new_hash_enc;
-    if (!(ctx->table_symbol = calloc(1, sizeof(uint8_t) * ctx->hash_size)))
+    if (!(ctx->table_symbol = table_alloc(sizeof(uint8_t) * ctx->hash_size)))
         goto abort_new_hash_enc;
         
     return true;
@@ -105,6 +508,11 @@ void hash_insert(lzw_context_enc *ctx, uint64_t index)
     ctx->table_symbol[index] = ctx->new_symbol;
 }
 
+static inline FORCE_INLINE uint32_t hash_code(lzw_context_enc *ctx, uint64_t index)
+{
+    return ctx->table_code[index];
+}
+
 FORCE_INLINE void hash_function_xor(lzw_context_enc *ctx, uint64_t* index)
 {
     *index = ((uint64_t)ctx->new_symbol << ctx->hash_shift) ^ (uint64_t)ctx->current_parent_code;
@@ -114,18 +522,24 @@ FORCE_INLINE void hash_function_xor(lzw_context_enc *ctx, uint64_t* index)
 int hash_lookup(lzw_context_enc *ctx, uint64_t* index)
 {
     uint32_t offset;
+    STATS(uint32_t probes = 0;)
 
     hash_function_xor(ctx, index);
     offset = (*index) ? ((uint32_t)ctx->hash_size - *index) : (uint32_t)1;
 
     while (1)
     {
+        STATS(probes++;)
         if (ctx->table_code[*index] == LZW_CODE_EMPTY)
+        {
+            STATS(lzw_stats_lookup(ctx, probes, 0);)
             return 0;
+        }
 
         if ((ctx->table_parent[*index] == ctx->current_parent_code)
             && (ctx->table_symbol[*index] == ctx->new_symbol))
         {
+            STATS(lzw_stats_lookup(ctx, probes, 1);)
             return 1;
         }
  
@@ -135,6 +549,16 @@ int hash_lookup(lzw_context_enc *ctx, uint64_t* index)
             *index -= offset;
     }
 }
+#endif
+
+#ifndef USE_TRIE
+#define dict_init    hash_init
+#define dict_free    hash_free
+#define dict_reset   hash_reset
+#define dict_lookup  hash_lookup
+#define dict_insert  hash_insert
+#define dict_code    hash_code
+#endif
 
 void lzw_context_enc_delete(lzw_context_enc *ctx)
 {
@@ -142,41 +566,50 @@ void lzw_context_enc_delete(lzw_context_enc *ctx)
     {
         if (ctx->f_src)
             fclose(ctx->f_src);
+        if (ctx->io_src)
+            iothread_close(ctx->io_src);
         if (ctx->b_dst)
             bitio_close(ctx->b_dst);
 
-        hash_free(ctx);
+        dict_free(ctx);
 
         memset(ctx, 0, sizeof(lzw_context_enc));
         free(ctx);
     }
 }
 
-static FORCE_INLINE void lzw_context_enc_reset(lzw_context_enc *ctx)
+static inline FORCE_INLINE void lzw_context_enc_reset(lzw_context_enc *ctx)
 {
     assert(ctx);
 
+    STATS(lzw_stats_reset(ctx);)
     ctx->current_code_bits = 9;
     ctx->current_max_code  = 512;
     ctx->new_code = LZW_CODE_START;
-    hash_reset(ctx);
+    ctx->gap_check = UINT64_MAX;
+    ctx->gap_bits = 0;
+    ctx->gap_last = 0;
+    if (!++ctx->run_gen) /* le catene valgono solo per la generazione corrente */
+    {
+        memset(ctx->runs, 0, sizeof(ctx->runs));
+        ctx->run_gen = 1;
+    }
+    dict_reset(ctx);
 }
 
-static FORCE_INLINE void lzw_context_enc_extend_codes(lzw_context_enc *ctx)
+static inline FORCE_INLINE void lzw_context_enc_extend_codes(lzw_context_enc *ctx)
 {
     ctx->current_code_bits++;
     ctx->current_max_code <<= 1;
 }
 
-lzw_context_enc *
-lzw_context_enc_new(const char *src_file, const char *dst_file,
-                    uint8_t ratio)
+/* contesto senza file associati, usato anche per i singoli blocchi.
+   reset: LZW_RESET_FULL, LZW_RESET_ADAPTIVE o la dimensione della tabella */
+lzw_context_enc *lzw_context_enc_alloc(uint8_t ratio, uint32_t reset)
 {
     lzw_context_enc *ctx = NULL;
     uint8_t max_bits = ratio + CODE_MIN_MAX_BITS;
 
-    assert(src_file && dst_file);
-
     if (ratio > (CODE_MAX_MAX_BITS - CODE_MIN_MAX_BITS))
     {
         fprintf(stderr, "wrong compression ratio argument, "
@@ -184,129 +617,1102 @@ lzw_context_enc_new(const char *src_file, const char *dst_file,
         max_bits = CODE_MIN_MAX_BITS;
     }
 
-    if ( !(ctx = calloc(1, sizeof(struct lzw_context_enc))) ||
-         !(ctx->f_src = fopen(src_file, "rb")) ||
-         !(ctx->b_dst = bitio_open(dst_file, O_WRONLY)) )
-        goto abort_new_context_enc;  /* Yeah, I'm a bad person */
+    if (!(ctx = calloc(1, sizeof(struct lzw_context_enc))))
+        return NULL;
 
     ctx->code_max_bits = max_bits;
     ctx->code_max = (uint32_t)(1 << ctx->code_max_bits);
 
-    if (!hash_init(ctx))
-        goto abort_new_context_enc;
-
     ctx->table_max = ctx->code_max;
+    if (reset == LZW_RESET_ADAPTIVE)
+    {
+        ctx->adaptive = true;
+        ctx->table_max = 0;
+    }
+    else if (reset >= LZW_RESET_MIN && reset <= ctx->code_max)
+        ctx->table_max = reset;
+    else if (reset != LZW_RESET_FULL)
+        fprintf(stderr, "wrong reset interval argument, "
+                "setting to default: %u\n", ctx->code_max);
+
+    /* la tabella si dimensiona su table_max */
+    if (!dict_init(ctx))
+    {
+        lzw_context_enc_delete(ctx);
+        return NULL;
+    }
+
+    lzw_context_enc_reset(ctx);
+    ctx->current_parent_code = LZW_CODE_EMPTY; /* nessun simbolo letto */
+    return ctx;
+}
+
+/* table max dell'header, il decoder riconosce il reset adattivo dal flag */
+static uint32_t lzw_table_max_field(lzw_context_enc *ctx)
+{
+    return (ctx->adaptive ? (ctx->code_max | LZW_TABLE_CLEAR) : ctx->table_max) |
+           (ctx->checksum ? LZW_TABLE_CHECKSUM : 0) |
+           (ctx->plain ? LZW_TABLE_PLAIN : 0) |
+           (ctx->store ? LZW_TABLE_STORED : 0);
+}
 
+static void lzw_write_header(lzw_context_enc *ctx)
+{
     /* header magic */
     bitio_write(ctx->b_dst, (uint64_t)HEADER_MAGIC, 24);
     /* lunghezza codifica massima */
     bitio_write(ctx->b_dst, (uint64_t)ctx->code_max_bits, 8);
     /* dimensio1ne reset tabella */
-    bitio_write(ctx->b_dst, (uint64_t)ctx->table_max, 32);
+    bitio_write(ctx->b_dst, (uint64_t)lzw_table_max_field(ctx), 32);
+}
+
+/* collega input ed output, che il contesto chiude anche in caso di errore:
+   con LZW_FLAG_PIPELINE letture e scritture vanno su thread propri, mentre
+   il file mappato non ha letture da anticipare */
+static int lzw_context_enc_open(lzw_context_enc *ctx, int fd_src, int fd_dst,
+                                uint32_t flags, bool map)
+{
+    bool pipeline = (flags & LZW_FLAG_PIPELINE) != 0;
+
+    if (pipeline && !map &&
+        !(ctx->io_src = iothread_open(fd_src, O_RDONLY, IOTHREAD_BUFFERS, IOTHREAD_BUFFER_SIZE)))
+        perror("iothread_open");
+
+    if (!ctx->io_src && !(ctx->f_src = fdopen(fd_src, "rb")))
+        safe_close(fd_src);
+    if (!(ctx->b_dst = bitio_fdopen(fd_dst, O_WRONLY)))
+        safe_close(fd_dst);
+    else if (pipeline && bitio_async(ctx->b_dst))
+        perror("bitio_async");
+
+    return ((ctx->f_src || ctx->io_src) && ctx->b_dst) ? 0 : -1;
+}
+
+/* il contesto prende possesso dei due fd anche in caso di errore */
+lzw_context_enc *
+lzw_context_enc_new(int fd_src, int fd_dst, uint8_t ratio, uint32_t reset,
+                    uint32_t flags, bool map)
+{
+    lzw_context_enc *ctx = NULL;
+
+    if (!(ctx = lzw_context_enc_alloc(ratio, reset)))
+    {
+        safe_close(fd_src);
+        safe_close(fd_dst);
+        return NULL;
+    }
+    ctx->checksum = (flags & LZW_FLAG_CHECKSUM) != 0;
+    ctx->plain = (flags & LZW_FLAG_PLAIN) != 0;
+    ctx->store = (flags & LZW_FLAG_STORE) != 0;
+
+    if (lzw_context_enc_open(ctx, fd_src, fd_dst, flags, map) != 0)
+    {
+        lzw_context_enc_delete(ctx);
+        return NULL;
+    }
+
+    lzw_write_header(ctx);
 
-    lzw_context_enc_reset(ctx);
     printf("* max code bits       : %d\n", ctx->code_max_bits);
     return ctx;
-
-    abort_new_context_enc:
-    lzw_context_enc_delete(ctx);
-    return NULL;
 }
 
-#ifdef USE_TRUNCATE_BIT_ENCODING
-void truncated_binary_enc(lzw_context_enc *ctx)
+static inline FORCE_INLINE void truncated_binary_enc(lzw_context_enc *ctx, struct bitio_wr *wr)
 {
     uint32_t u = ctx->current_max_code - ctx->new_code;
     if (ctx->current_parent_code < u)
-        bitio_write(ctx->b_dst, (uint64_t)ctx->current_parent_code, ctx->current_code_bits-1);
+    {
+        STATS(ctx->stats.width[ctx->current_code_bits - 1]++;)
+        bitio_wr_put(wr, (uint64_t)ctx->current_parent_code, ctx->current_code_bits-1);
+    }
+    else
+    {
+        STATS(ctx->stats.width[ctx->current_code_bits]++;)
+        bitio_wr_put(wr, (uint64_t)(ctx->current_parent_code + u), ctx->current_code_bits);
+    }
+}
+
+/* wr è il writer di ctx->b_dst, aperto dal chiamante; plain è costante
+   nei kernel, il ramo sparisce */
+static inline FORCE_INLINE void lzw_write_code(lzw_context_enc *ctx, struct bitio_wr *wr,
+                                               const bool plain)
+{
+    if (!plain)
+        truncated_binary_enc(ctx, wr);
     else
-        bitio_write(ctx->b_dst, (uint64_t)(ctx->current_parent_code + u), ctx->current_code_bits);
+    {
+        STATS(ctx->stats.width[ctx->current_code_bits]++;)
+        bitio_wr_put(wr, (uint64_t)ctx->current_parent_code, ctx->current_code_bits);
+    }
 }
-#endif
 
-/********* compress function *********/
-int compress_lzw(const char *src_file, const char *dst_file, uint8_t ratio)
+/* reset adattivo, chiamata per ogni codice scritto a dizionario pieno:
+   pos è l'offset nell'input dopo il codice, ritorna true per il CLEAR */
+static bool lzw_adaptive_check(lzw_context_enc *ctx, uint64_t pos)
 {
-    int ret = 0;
-    uint64_t index;
-    lzw_context_enc *ctx = NULL;
+    uint32_t bpb;
+    uint8_t k;
 
-    static char rd_block[READ_BLOCK_SIZE];
-    int16_t rd_block_pos = 0, rd_block_last = 0;
+    /* dizionario appena riempito: i codici scritti riempiendolo, uno per
+       code da LZW_CODE_START, 9 bit fino a 511 e poi k bit per i 2^(k-1)
+       successivi (senza il troncamento) */
+    if (ctx->gap_check == UINT64_MAX)
+    {
+        ctx->gap_check = pos;
+        ctx->gap_bits = 9 * (512 - LZW_CODE_START);
+        for (k = 10; k <= ctx->code_max_bits; k++)
+            ctx->gap_bits += (uint64_t)k << (k - 1);
+        ctx->gap_last = (uint32_t)((ctx->gap_bits << 8) / (pos - ctx->gap_reset + 1));
+        return false;
+    }
 
-    assert(src_file && dst_file);
+    ctx->gap_bits += ctx->current_code_bits;
+    if (pos - ctx->gap_check < ADAPTIVE_GAP && pos - ctx->gap_check < ctx->code_max)
+        return false;
+    ctx->gap_check = pos;
 
-    if (!(ctx = lzw_context_enc_new(src_file, dst_file, ratio)))
+    /* dall'ultimo reset: un dizionario vecchio che resta stabilmente
+       cattivo peggiora il rapporto anche senza peggiorare ancora */
+    bpb = (uint32_t)((ctx->gap_bits << 8) / (pos - ctx->gap_reset));
+    if (bpb >= ADAPTIVE_CAP || (ctx->gap_last && bpb > ctx->gap_last))
     {
-        perror("lzw_new_context");
-        return -1;
+        ctx->gap_reset = pos;
+        return true;
     }
 
-    /* leggiamo il primo blocco di byte dal file caricando il buffer locale */
-    if (rd_block_pos == rd_block_last &&
-    (rd_block_last = fread(rd_block, sizeof(char), READ_BLOCK_SIZE, ctx->f_src)) <= 0)
-        exit(1);
+    ctx->gap_last = bpb;
+    return false;
+}
 
-    /* setto il nuovo carattere nel context */
-    ctx->current_parent_code = (uint8_t)rd_block[rd_block_pos++];
+static inline FORCE_INLINE lzw_run *lzw_run_get(lzw_context_enc *ctx, uint8_t c)
+{
+    lzw_run *run = &ctx->runs[c];
 
-    while (1)
+    if (run->gen != ctx->run_gen)
     {
-        /* il buffer locale è finito, carichiamo un nuovo blocco di byte dal file */
-        if (rd_block_pos == rd_block_last)
-        {
-            /* quando finisce il file ritorna la read ritorna 0 ed esce */
-            if ((rd_block_last = fread(rd_block, sizeof(char), READ_BLOCK_SIZE, ctx->f_src)) <= 0)
-                break;
-            rd_block_pos = 0;
-        }
+        run->gen = ctx->run_gen;
+        run->top = c;
+        run->len = 1;
+    }
+    return run;
+}
 
-        /* setto il nuovo carattere nel context */
-        ctx->new_symbol = (uint8_t)rd_block[rd_block_pos++];
-        /* ricerca nell'hash */
-        if (!hash_lookup(ctx, &index))
-        {
-            /* scrivo il parent_code nella bitio */
-#ifdef USE_TRUNCATE_BIT_ENCODING 
-            truncated_binary_enc(ctx);
-#else
-            bitio_write(ctx->b_dst, ctx->current_parent_code, ctx->current_code_bits);
-#endif
+/* byte uguali a c all'inizio di buf, al più max */
+static size_t run_length(const uint8_t *buf, const uint8_t *end, uint8_t c, size_t max)
+{
+    uint64_t pattern = UINT64_C(0x0101010101010101) * c, w;
+    size_t n = 0;
 
-            if (ctx->new_code < ctx->code_max)
-            {
-                hash_insert(ctx, index);
-                if (ctx->new_code == ctx->current_max_code)
-                    lzw_context_enc_extend_codes(ctx);
-            }
+    if (max > (size_t)(end - buf))
+        max = end - buf;
+    for (; n + 8 <= max; n += 8)
+    {
+        memcpy(&w, buf + n, 8);
+        if (w != pattern)
+            break;
+    }
+    while (n < max && buf[n] == c)
+        n++;
+    return n;
+}
 
-            /* svuota tabella hash e resetta il contesto */
-            if (ctx->new_code++ == ctx->table_max)
-                lzw_context_enc_reset(ctx);
+/* il parent c ripetuto run_pending volte diventa il suo code, con le
+   ricerche saltate da lzw_run_skip: la catena arriva più in alto */
+static void lzw_run_resolve(lzw_context_enc *ctx)
+{
+    uint64_t index;
+    uint32_t k;
 
-            /* aggiorno il parent all'index del nuovo simbolo */
-            ctx->current_parent_code = ctx->new_symbol;
+    ctx->new_symbol = (uint8_t)ctx->current_parent_code;
+    for (k = 1; k < ctx->run_pending; k++)
+    {
+        dict_lookup(ctx, &index);
+        ctx->current_parent_code = dict_code(ctx, index);
+    }
+    ctx->run_pending = 0;
+}
+
+/* il parent è un carattere c (o c ripetuto run_pending volte) e buf inizia
+   con c: se la catena di c è lunga si prende il code della corsa intera,
+   la stringa che la ricerca byte per byte troverebbe. se buf finisce prima
+   la corsa resta in sospeso, ritorna il nuovo inizio di buf */
+static const uint8_t *lzw_run_skip(lzw_context_enc *ctx, const uint8_t *buf, const uint8_t *end)
+{
+    uint8_t c = (uint8_t)ctx->current_parent_code;
+    lzw_run *run = lzw_run_get(ctx, c);
+    uint32_t have = ctx->run_pending ? ctx->run_pending : 1;
+    size_t n;
+
+    if (run->len < RUN_MIN)
+        return buf;
+
+    n = run_length(buf, end, c, run->len - have);
+    if (n == run->len - have)
+    {
+        ctx->current_parent_code = run->top;
+        ctx->run_pending = 0;
+    }
+    else if (buf + n == end) /* prosegue nel buffer successivo */
+        ctx->run_pending = have + (uint32_t)n;
+    else if (ctx->run_pending)
+    {
+        ctx->run_pending = have + (uint32_t)n;
+        lzw_run_resolve(ctx);
+    }
+    else
+        return buf; /* corsa corta, ci pensa la ricerca */
+
+    return buf + n;
+}
+
+/* codifica len byte di buf proseguendo dallo stato del contesto, un
+   kernel per codifica dei codici (vedi lzw_encode) */
+static inline FORCE_INLINE void lzw_encode_kernel(lzw_context_enc *ctx, const uint8_t *buf,
+                                                  size_t len, const bool plain)
+{
+    uint64_t index;
+    const uint8_t *start = buf, *end = buf + len;
+    struct bitio_wr wr;
+    lzw_run *run;
+
+    /* il primo carattere dello stream diventa il parent */
+    if (buf != end && ctx->current_parent_code == LZW_CODE_EMPTY)
+        ctx->current_parent_code = *buf++;
+    if (ctx->run_pending)
+        buf = lzw_run_skip(ctx, buf, end);
+
+    bitio_wr_open(ctx->b_dst, &wr);
+
+    while (buf != end)
+    {
+        /* setto il nuovo carattere nel context */
+        ctx->new_symbol = *buf++;
+        /* ricerca nel dizionario */
+        if (!dict_lookup(ctx, &index))
+        {
+            /* scrivo il parent_code nella bitio */
+            lzw_write_code(ctx, &wr, plain);
+            STATS(ctx->stats.strings++;)
+
+            if (ctx->new_code < ctx->code_max)
+            {
+                dict_insert(ctx, index);
+                run = lzw_run_get(ctx, ctx->new_symbol);
+                if (ctx->current_parent_code == run->top)
+                {
+                    run->top = ctx->new_code;
+                    run->len++;
+                }
+                if (ctx->new_code == ctx->current_max_code)
+                    lzw_context_enc_extend_codes(ctx);
+            }
+            else if (ctx->adaptive) /* new_code resta a code_max fino al CLEAR */
+            {
+                if (lzw_adaptive_check(ctx, ctx->in_bytes + (uint64_t)(buf - start) - 1))
+                {
+                    STATS(ctx->stats.width[ctx->current_code_bits]++;)
+                    bitio_wr_put(&wr, LZW_CODE_CLEAR, ctx->current_code_bits);
+                    lzw_context_enc_reset(ctx);
+                }
+                ctx->current_parent_code = ctx->new_symbol;
+                if (buf != end && *buf == ctx->new_symbol)
+                    buf = lzw_run_skip(ctx, buf, end);
+                continue;
+            }
+
+            /* svuota tabella hash e resetta il contesto */
+            if (ctx->new_code++ == ctx->table_max)
+                lzw_context_enc_reset(ctx);
+
+            /* aggiorno il parent all'index del nuovo simbolo */
+            ctx->current_parent_code = ctx->new_symbol;
+            if (buf != end && *buf == ctx->new_symbol)
+                buf = lzw_run_skip(ctx, buf, end);
         }
-        else /* aggiorno il parent_code con il code trovato nell'hashtable */
-            ctx->current_parent_code = ctx->table_code[index];
+        else /* aggiorno il parent_code con il code trovato nel dizionario */
+            ctx->current_parent_code = dict_code(ctx, index);
+    }
+
+    ctx->in_bytes += len;
+    bitio_wr_close(&wr);
+}
+
+static void lzw_encode_truncated(lzw_context_enc *ctx, const uint8_t *buf, size_t len)
+{
+    lzw_encode_kernel(ctx, buf, len, false);
+}
+
+static void lzw_encode_plain(lzw_context_enc *ctx, const uint8_t *buf, size_t len)
+{
+    lzw_encode_kernel(ctx, buf, len, true);
+}
+
+/* scrive l'ultimo parent_code ed il codice di EOF */
+static void lzw_write_eof(lzw_context_enc *ctx, struct bitio_wr *wr)
+{
+    /* il decoder aggiorna lo stato anche dopo l'ultimo codice letto
+       (estensione e reset), l'EOF va scritto con lo stesso stato */
+    if (ctx->run_pending)
+        lzw_run_resolve(ctx);
+    if (ctx->current_parent_code != LZW_CODE_EMPTY)
+    {
+        lzw_write_code(ctx, wr, ctx->plain);
+        STATS(ctx->stats.strings++;)
+        if (ctx->new_code < ctx->code_max && ctx->new_code == ctx->current_max_code)
+            lzw_context_enc_extend_codes(ctx);
+        if (!(ctx->adaptive && ctx->new_code == ctx->code_max) &&
+            ctx->new_code++ == ctx->table_max)
+            lzw_context_enc_reset(ctx);
     }
-    
-    /* il file è finito scriviamo l'ultimo parent_code */
-#ifdef USE_TRUNCATE_BIT_ENCODING
-    truncated_binary_enc(ctx);
-#else
-    bitio_write(ctx->b_dst, (uint64_t)ctx->current_parent_code, ctx->current_code_bits);
-#endif
     ctx->current_parent_code = (uint64_t)LZW_CODE_EOF;
+    lzw_write_code(ctx, wr, ctx->plain);
+}
 
-    /* scriviamo il codice di EOF */
-#ifdef USE_TRUNCATE_BIT_ENCODING 
-    truncated_binary_enc(ctx);
-#else
-    bitio_write(ctx->b_dst, (uint64_t)ctx->current_parent_code, ctx->current_code_bits);
+/* log2(x) con 8 bit di frazione, x > 0 */
+static uint32_t log2_fp8(uint32_t x)
+{
+    uint32_t r = (31 - __builtin_clz(x)) << 8, bit;
+    uint64_t m = (uint64_t)x << 15 >> (r >> 8); /* mantissa in [2^15, 2^16) */
+
+    for (bit = 128; bit; bit >>= 1)
+    {
+        m = (m * m) >> 15;
+        if (m >= (1 << 16))
+        {
+            m >>= 1;
+            r |= bit;
+        }
+    }
+    return r;
+}
+
+/* true se i len byte di buf hanno entropia d'ordine 0 sopra STORE_ENTROPY */
+static bool lzw_store_probe(const uint8_t *buf, size_t len)
+{
+    uint32_t count[256] = { 0 };
+    uint64_t bits;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        count[buf[i]]++;
+
+    /* len log2 len - sum c log2 c */
+    bits = (uint64_t)len * log2_fp8((uint32_t)len);
+    for (i = 0; i < 256; i++)
+        if (count[i])
+            bits -= (uint64_t)count[i] * log2_fp8(count[i]);
+
+    return bits >= (uint64_t)len * STORE_ENTROPY;
+}
+
+/* segmento memorizzato: i codici si chiudono con un EOF come a fine stream,
+   seguono dalla parola successiva la lunghezza (64 bit) ed i byte di buf
+   in parole intere; il dizionario resta quello dei codici precedenti */
+static void lzw_encode_stored(lzw_context_enc *ctx, const uint8_t *buf, size_t len)
+{
+    struct bitio_wr wr;
+    uint64_t word;
+    size_t i, n;
+
+    bitio_wr_open(ctx->b_dst, &wr);
+    lzw_write_eof(ctx, &wr);
+    ctx->current_parent_code = LZW_CODE_EMPTY;
+
+    bitio_wr_align(&wr);
+    bitio_wr_put(&wr, (uint64_t)len, 64);
+    for (i = 0; i < len; i += n)
+    {
+        n = len - i < 8 ? len - i : 8;
+        word = 0;
+        memcpy(&word, buf + i, n);
+        bitio_wr_put(&wr, le64toh(word), 64);
+    }
+    bitio_wr_close(&wr);
+
+    STATS(ctx->stats.stored += len;)
+    ctx->in_bytes += len;
+    ctx->gap_reset += len; /* fuori dal rapporto del reset adattivo */
+}
+
+static void lzw_encode(lzw_context_enc *ctx, const uint8_t *buf, size_t len)
+{
+    size_t n;
+
+    /* il buffer è ancora in cache */
+    if (ctx->checksum)
+        ctx->crc = checksum_crc32c(ctx->crc, buf, len);
+
+    for (; len; buf += n, len -= n)
+    {
+        n = len;
+        if (ctx->store)
+        {
+            /* il modo si sceglie con i byte del segmento che ci sono */
+            if (!ctx->segment_left)
+            {
+                ctx->segment_left = STORE_SEGMENT;
+                ctx->storing = len >= STORE_PROBE_MIN &&
+                               lzw_store_probe(buf, len < STORE_SEGMENT ? len : STORE_SEGMENT);
+            }
+            if (n > ctx->segment_left)
+                n = ctx->segment_left;
+            ctx->segment_left -= n;
+
+            if (ctx->storing)
+            {
+                lzw_encode_stored(ctx, buf, n);
+                continue;
+            }
+        }
+
+        if (ctx->plain)
+            lzw_encode_plain(ctx, buf, n);
+        else
+            lzw_encode_truncated(ctx, buf, n);
+    }
+}
+
+static void lzw_encode_end(lzw_context_enc *ctx)
+{
+    struct bitio_wr wr;
+
+    bitio_wr_open(ctx->b_dst, &wr);
+    lzw_write_eof(ctx, &wr);
+
+    /* segmento di lunghezza 0: fine dello stream */
+    if (ctx->store)
+    {
+        bitio_wr_align(&wr);
+        bitio_wr_put(&wr, 0, 64);
+    }
+
+    /* lo stream successivo ricomincia da zero */
+    if (ctx->checksum)
+        bitio_wr_put(&wr, ctx->crc, 32);
+    ctx->crc = 0;
+
+    bitio_wr_close(&wr);
+}
+
+/********* statistics *********/
+#ifdef USE_STATS
+static void lzw_stats_merge(lzw_stats *dst, const lzw_stats *src)
+{
+    int i;
+
+    if (src->resets && (!dst->resets || src->load_min < dst->load_min))
+        dst->load_min = src->load_min;
+    if (src->load_max > dst->load_max)
+        dst->load_max = src->load_max;
+    dst->load_sum += src->load_sum;
+    dst->resets   += src->resets;
+    dst->lookups  += src->lookups;
+    dst->hits     += src->hits;
+    dst->probes   += src->probes;
+    dst->strings  += src->strings;
+    dst->stored   += src->stored;
+    for (i = 0; i <= STATS_PROBES_MAX; i++)
+        dst->probe_hist[i] += src->probe_hist[i];
+    for (i = 0; i <= CODE_MAX_MAX_BITS; i++)
+        dst->width[i] += src->width[i];
+}
+
+/* load < 0: nessun dizionario aperto a fine input (blocchi) */
+static void lzw_stats_print(const lzw_stats *st, uint64_t in_bytes, double load)
+{
+    uint64_t lookups = st->lookups ? st->lookups : 1;
+    int i, n = 0;
+
+    printf("\n* dictionary lookups  : %" PRIu64 " (hit %.2f%%, miss %.2f%%)\n",
+           st->lookups, 100.0 * st->hits / lookups,
+           100.0 * (st->lookups - st->hits) / lookups);
+    printf("* probes per lookup   : %.3f\n", (double)st->probes / lookups);
+    printf("* probes histogram    :");
+    for (i = 1; i <= STATS_PROBES_MAX; i++)
+        if (st->probe_hist[i])
+            printf("%s %d%s: %.3f%%", n++ % 4 ? "" : "\n   ", i,
+                   i == STATS_PROBES_MAX ? "+" : "", 100.0 * st->probe_hist[i] / lookups);
+    printf("\n* dictionary resets   : %" PRIu64 "\n", st->resets);
+    if (st->resets)
+        printf("* load at reset       : min %.3f, mean %.3f, max %.3f\n",
+               st->load_min, st->load_sum / st->resets, st->load_max);
+    if (load >= 0)
+        printf("* load at end         : %.3f\n", load);
+    printf("* codes per width     :");
+    for (i = 0, n = 0; i <= CODE_MAX_MAX_BITS; i++)
+        if (st->width[i])
+            printf("%s %2d: %" PRIu64, n++ % 4 ? "" : "\n   ", i, st->width[i]);
+    printf("\n* mean match length   : %.3f bytes\n",
+           st->strings ? (double)(in_bytes - st->stored) / st->strings : 0);
+    if (st->stored)
+        printf("* stored bytes        : %" PRIu64 " (%.2f%%)\n",
+               st->stored, 100.0 * st->stored / in_bytes);
+}
+#endif
+
+/* apre src_file in lettura e dst_file in scrittura */
+static bool open_files(const char *src_file, const char *dst_file, int *fd_src, int *fd_dst)
+{
+    if ((*fd_src = open(src_file, O_RDONLY)) < 0)
+        return false;
+
+    if ((*fd_dst = open(dst_file, O_WRONLY | O_CREAT | O_TRUNC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0)
+    {
+        safe_close(*fd_src);
+        return false;
+    }
+
+    return true;
+}
+
+/********* compress function *********/
+int compress_lzw(const char *src_file, const char *dst_file, uint8_t ratio)
+{
+    int fd_src, fd_dst;
+
+    assert(src_file && dst_file);
+
+    if (!open_files(src_file, dst_file, &fd_src, &fd_dst))
+    {
+        perror("open");
+        return -1;
+    }
+
+    return compress_lzw_fd(fd_src, fd_dst, ratio, LZW_RESET_FULL, 0);
+}
+
+/* codifica tutto ctx->f_src, con il file mappato in un solo passo
+   (letture comprese), o i buffer letti in anticipo da ctx->io_src */
+static void lzw_encode_file(lzw_context_enc *ctx, uint8_t *map, size_t map_size)
+{
+    char rd_block[READ_BLOCK_SIZE];
+    int16_t rd_block_last = 0;
+    uint8_t *buf;
+    size_t count;
+
+    if (map)
+    {
+        phase_switch(PHASE_CODE);
+        lzw_encode(ctx, map, map_size);
+    }
+    else if (ctx->io_src)
+    {
+        phase_switch(PHASE_CODE);
+        while ((buf = iothread_read_buf(ctx->io_src, &count), count))
+            lzw_encode(ctx, buf, count);
+    }
+    else /* quando finisce il file la fread ritorna 0 ed esce */
+        while (phase_switch(PHASE_INPUT),
+               (rd_block_last = fread(rd_block, sizeof(char), READ_BLOCK_SIZE, ctx->f_src)) > 0)
+        {
+            phase_switch(PHASE_CODE);
+            lzw_encode(ctx, (uint8_t*)rd_block, rd_block_last);
+        }
+
+    /* il file è finito scriviamo l'ultimo parent_code ed il codice di EOF */
+    phase_switch(PHASE_CODE);
+    lzw_encode_end(ctx);
+}
+
+int compress_lzw_fd(int fd_src, int fd_dst, uint8_t ratio, uint32_t reset, uint32_t flags)
+{
+    int ret = 0;
+    lzw_context_enc *ctx = NULL;
+    uint8_t *map = NULL;
+    size_t map_size = 0;
+    int phase = phase_switch(PHASE_ALLOC);
+
+    if ((flags & LZW_FLAG_MMAP) && !(map = file_map_read(fd_src, &map_size)))
+        fprintf(stderr, "mmap not available on input, using read\n");
+
+    if (!(ctx = lzw_context_enc_new(fd_src, fd_dst, ratio, reset, flags, map != NULL)))
+    {
+        perror("lzw_new_context");
+        file_unmap(map, map_size);
+        phase_switch(phase);
+        return -1;
+    }
+
+    lzw_encode_file(ctx, map, map_size);
+
+#ifdef USE_STATS
+    if (flags & LZW_FLAG_STATS)
+        lzw_stats_print(&ctx->stats, ctx->in_bytes, lzw_stats_load(ctx));
 #endif
 
     /* liberiamo la memoria deallocando il contesto */
+    phase_switch(PHASE_FREE);
+    lzw_context_enc_delete(ctx);
+    file_unmap(map, map_size);
+    phase_switch(phase);
+    return ret;
+}
+
+/* come compress_lzw_fd con il contesto di una chiamata precedente: le
+   tabelle restano allocate ed il reset del dizionario basta */
+int compress_lzw_ctx_fd(struct lzw_context_enc **pctx, int fd_src, int fd_dst,
+                        uint8_t ratio, uint32_t reset, uint32_t flags)
+{
+    lzw_context_enc *ctx = *pctx;
+    uint8_t *map = NULL;
+    size_t map_size = 0;
+    int ret = 0, phase = phase_switch(PHASE_ALLOC);
+
+    if (!ctx && !(ctx = *pctx = lzw_context_enc_alloc(ratio, reset)))
+    {
+        perror("lzw_new_context");
+        safe_close(fd_src);
+        safe_close(fd_dst);
+        phase_switch(phase);
+        return -1;
+    }
+
+    if (ctx->new_code != LZW_CODE_START)
+        lzw_context_enc_reset(ctx);
+    ctx->current_parent_code = LZW_CODE_EMPTY;
+    ctx->run_pending = 0;
+    ctx->segment_left = 0;
+    ctx->in_bytes = 0;
+    ctx->gap_reset = 0;
+    ctx->checksum = (flags & LZW_FLAG_CHECKSUM) != 0;
+    ctx->plain = (flags & LZW_FLAG_PLAIN) != 0;
+    ctx->store = (flags & LZW_FLAG_STORE) != 0;
+
+    if ((flags & LZW_FLAG_MMAP) && !(map = file_map_read(fd_src, &map_size)))
+        fprintf(stderr, "mmap not available on input, using read\n");
+
+    if (lzw_context_enc_open(ctx, fd_src, fd_dst, flags, map != NULL) == 0)
+    {
+        lzw_write_header(ctx);
+        lzw_encode_file(ctx, map, map_size);
+    }
+    else
+    {
+        perror("open");
+        ret = -1;
+    }
+
+    phase_switch(PHASE_FREE);
+    if (ctx->f_src)
+        fclose(ctx->f_src);
+    if (ctx->io_src)
+        iothread_close(ctx->io_src);
+    if (ctx->b_dst)
+        bitio_close(ctx->b_dst);
+    ctx->f_src = NULL;
+    ctx->io_src = NULL;
+    ctx->b_dst = NULL;
+    file_unmap(map, map_size);
+    phase_switch(phase);
+    return ret;
+}
+
+void compress_lzw_ctx_delete(struct lzw_context_enc *ctx)
+{
+    lzw_context_enc_delete(ctx);
+}
+
+/********* memory compression *********/
+int compress_lzw_mem(const uint8_t *src, size_t src_len,
+                     uint8_t *dst, size_t *dst_len, uint8_t ratio)
+{
+    lzw_context_enc *ctx = NULL;
+
+    assert((src || !src_len) && dst && dst_len);
+
+    if (!(ctx = lzw_context_enc_alloc(ratio, LZW_RESET_FULL)))
+        return -1;
+
+    if (!(ctx->b_dst = bitio_open_mem(dst, *dst_len, O_WRONLY)))
+    {
+        lzw_context_enc_delete(ctx);
+        return -1;
+    }
+
+    lzw_write_header(ctx);
+    lzw_encode(ctx, src, src_len);
+    lzw_encode_end(ctx);
+
+    /* NULL se dst non basta, errno è ENOSPC */
+    dst = bitio_close_mem(ctx->b_dst, dst_len);
+    ctx->b_dst = NULL;
     lzw_context_enc_delete(ctx);
+
+    return dst ? 0 : -1;
+}
+
+size_t compress_lzw_bound(size_t src_len, uint8_t ratio)
+{
+    uint8_t max_bits = ratio + CODE_MIN_MAX_BITS;
+
+    if (ratio > (CODE_MAX_MAX_BITS - CODE_MIN_MAX_BITS))
+        max_bits = CODE_MIN_MAX_BITS;
+
+    /* header, al più un codice per byte più l'EOF, parole da 64 bit */
+    return 8 + (((uint64_t)src_len + 1) * max_bits + 63) / 64 * 8;
+}
+
+/********* push compression *********/
+lzw_context_enc *compress_lzw_push_new(uint8_t ratio)
+{
+    lzw_context_enc *ctx;
+
+    if (!(ctx = lzw_context_enc_alloc(ratio, LZW_RESET_FULL)))
+        return NULL;
+
+    if (!(ctx->b_dst = bitio_open_mem(NULL, 0, O_WRONLY)))
+    {
+        lzw_context_enc_delete(ctx);
+        return NULL;
+    }
+
+    lzw_write_header(ctx);
+    return ctx;
+}
+
+int compress_lzw_push_update(lzw_context_enc *ctx, const uint8_t *src, size_t *src_len,
+                             uint8_t *dst, size_t *dst_len)
+{
+    size_t in = 0, out, n;
+
+    assert(ctx && src_len && dst_len && (src || !*src_len));
+
+    /* dopo la finish non si accetta altro input */
+    if (ctx->current_parent_code == LZW_CODE_EOF && *src_len)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    out = bitio_mem_drain(ctx->b_dst, dst, *dst_len);
+
+    /* nuovo input solo quando l'output precedente è stato consegnato */
+    while (in < *src_len && !bitio_mem_pending(ctx->b_dst))
+    {
+        n = *src_len - in;
+        if (n > PUSH_CHUNK_SIZE)
+            n = PUSH_CHUNK_SIZE;
+
+        lzw_encode(ctx, src + in, n);
+        in += n;
+
+        out += bitio_mem_drain(ctx->b_dst, dst + out, *dst_len - out);
+    }
+
+    *src_len = in;
+    *dst_len = out;
+    return 0;
+}
+
+int compress_lzw_push_finish(lzw_context_enc *ctx, uint8_t *dst, size_t *dst_len)
+{
+    assert(ctx && dst_len);
+
+    if (ctx->current_parent_code != LZW_CODE_EOF)
+    {
+        lzw_encode_end(ctx);
+        bitio_flush(ctx->b_dst);
+    }
+
+    *dst_len = bitio_mem_drain(ctx->b_dst, dst, *dst_len);
+
+    /* 1: dst pieno, va richiamata */
+    return bitio_mem_pending(ctx->b_dst) ? 1 : 0;
+}
+
+void compress_lzw_push_delete(lzw_context_enc *ctx)
+{
+    lzw_context_enc_delete(ctx);
+}
+
+/********* block compression *********/
+typedef struct lzw_blocks_enc
+{
+    uint8_t           ratio;
+    uint32_t          reset;
+    bool              checksum, plain, store;
+    lzw_context_enc **ctxs;    /* un contesto per worker */
+    uint8_t         **src;
+    size_t           *src_len;
+    uint8_t         **dst;
+    size_t           *dst_len;
+    bool              error;   /* scritto dai worker, con __atomic */
+} lzw_blocks_enc;
+
+static void compress_block_job(void *arg, uint32_t job, uint32_t worker)
+{
+    lzw_blocks_enc *be = arg;
+    lzw_context_enc *ctx = be->ctxs[worker];
+    int phase = phase_switch(PHASE_ALLOC);
+
+    if (!ctx && !(ctx = be->ctxs[worker] = lzw_context_enc_alloc(be->ratio, be->reset)))
+    {
+        __atomic_store_n(&be->error, true, __ATOMIC_RELAXED);
+        phase_switch(phase);
+        return;
+    }
+
+    /* ogni blocco parte da un dizionario vuoto */
+    phase_switch(PHASE_CODE);
+    if (ctx->new_code != LZW_CODE_START)
+        lzw_context_enc_reset(ctx);
+    ctx->current_parent_code = LZW_CODE_EMPTY;
+    ctx->run_pending = 0;
+    ctx->segment_left = 0;
+    ctx->gap_reset = ctx->in_bytes;
+    ctx->checksum = be->checksum;
+    ctx->plain = be->plain;
+    ctx->store = be->store;
+
+    if (!(ctx->b_dst = bitio_open_mem(NULL, 0, O_WRONLY)))
+    {
+        __atomic_store_n(&be->error, true, __ATOMIC_RELAXED);
+        phase_switch(phase);
+        return;
+    }
+
+    lzw_encode(ctx, be->src[job], be->src_len[job]);
+    lzw_encode_end(ctx);
+
+    be->dst[job] = bitio_close_mem(ctx->b_dst, &be->dst_len[job]);
+    ctx->b_dst = NULL;
+    phase_switch(phase);
+}
+
+static void block_write_header(int fd, uint8_t code_max_bits, uint32_t table_max,
+                               uint32_t block_size, uint32_t n_blocks,
+                               uint64_t table_offset, const block_entry *table)
+{
+    struct bitio *b;
+    uint8_t *mem;
+    size_t size;
+
+    if (!(b = bitio_open_mem(NULL, 0, O_WRONLY)))
+    {
+        perror("bitio_open_mem");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < n_blocks; i++)
+    {
+        bitio_write(b, table[i].offset, 64);
+        bitio_write(b, (uint64_t)table[i].csize, 32);
+        bitio_write(b, (uint64_t)table[i].usize, 32);
+    }
+    if ((mem = bitio_close_mem(b, &size)))
+        safe_pwrite(fd, mem, size, table_offset);
+    free(mem);
+
+    if (!(b = bitio_open_mem(NULL, 0, O_WRONLY)))
+    {
+        perror("bitio_open_mem");
+        exit(1);
+    }
+
+    bitio_write(b, (uint64_t)HEADER_MAGIC_BLOCK, 24);
+    bitio_write(b, (uint64_t)code_max_bits, 8);
+    bitio_write(b, (uint64_t)table_max, 32);
+    bitio_write(b, (uint64_t)block_size, 32);
+    bitio_write(b, (uint64_t)n_blocks, 32);
+    bitio_write(b, table_offset, 64);
+
+    mem = bitio_close_mem(b, &size);
+    safe_pwrite(fd, mem, size, 0);
+    free(mem);
+}
+
+int compress_lzw_blocks(const char *src_file, const char *dst_file,
+                        uint8_t ratio, uint32_t n_threads)
+{
+    int fd_src, fd_dst;
+
+    assert(src_file && dst_file);
+
+    if (!open_files(src_file, dst_file, &fd_src, &fd_dst))
+    {
+        perror("open");
+        return -1;
+    }
+
+    return compress_lzw_blocks_fd(fd_src, fd_dst, ratio, LZW_RESET_FULL, n_threads, 0);
+}
+
+int compress_lzw_seekable_fd(int fd_src, int fd_dst, uint8_t ratio, uint32_t reset,
+                             uint32_t n_threads, uint32_t block_size, uint32_t flags)
+{
+    int ret = -1;
+    uint32_t i, n, window, n_blocks = 0, n_reserved = 0;
+    uint64_t offset, table_offset = BLOCK_HEADER_SIZE;
+    block_entry *table = NULL;
+    lzw_blocks_enc be;
+    struct stat st;
+    uint8_t *map = NULL;
+    size_t map_size = 0, map_pos = 0;
+    int phase;
+
+    /* header e tabella si scrivono alla fine con pwrite */
+    if (lseek(fd_dst, 0, SEEK_CUR) < 0)
+    {
+        fprintf(stderr, "block container needs a seekable output, "
+                "compressing as a single stream\n");
+        return compress_lzw_fd(fd_src, fd_dst, ratio, reset, flags);
+    }
+
+    phase = phase_switch(PHASE_ALLOC);
+    if (!n_threads)
+        n_threads = 1;
+    window = 2 * n_threads; /* blocchi in memoria per ogni giro */
+    if (block_size < BLOCK_MIN_SIZE)
+        block_size = BLOCK_MIN_SIZE;
+    else if (block_size > BLOCK_MAX_SIZE)
+        block_size = BLOCK_MAX_SIZE;
+
+    memset(&be, 0, sizeof(be));
+    be.ratio   = ratio;
+    be.reset   = reset;
+    be.checksum = (flags & LZW_FLAG_CHECKSUM) != 0;
+    be.plain   = (flags & LZW_FLAG_PLAIN) != 0;
+    be.store   = (flags & LZW_FLAG_STORE) != 0;
+    be.ctxs    = my_calloc(n_threads, sizeof(lzw_context_enc*));
+    be.src     = my_calloc(window, sizeof(uint8_t*));
+    be.src_len = my_calloc(window, sizeof(size_t));
+    be.dst     = my_calloc(window, sizeof(uint8_t*));
+    be.dst_len = my_calloc(window, sizeof(size_t));
+
+    /* se conosciamo la dimensione la tabella dei blocchi va dopo l'header */
+    if (!fstat(fd_src, &st) && S_ISREG(st.st_mode))
+        n_reserved = (st.st_size + block_size - 1) / block_size;
+    offset = BLOCK_HEADER_SIZE + (uint64_t)n_reserved * BLOCK_ENTRY_SIZE;
+
+    /* con il file mappato i blocchi puntano direttamente nella mappa */
+    if ((flags & LZW_FLAG_MMAP) && !(map = file_map_read(fd_src, &map_size)))
+        fprintf(stderr, "mmap not available on input, using read\n");
+
+    for (i = 0; !map && i < window; i++)
+        be.src[i] = my_malloc(block_size);
+
+    if (!(be.ctxs[0] = lzw_context_enc_alloc(ratio, reset)))
+    {
+        perror("lzw_new_context");
+        goto end_compress_blocks;
+    }
+    be.ctxs[0]->checksum = be.checksum; /* per il campo dell'header */
+    be.ctxs[0]->plain = be.plain;
+    be.ctxs[0]->store = be.store;
+    printf("* max code bits       : %d\n", be.ctxs[0]->code_max_bits);
+
+    /* da qui i worker contano il loro tempo, il thread principale solo i/o */
+    phase_switch(PHASE_NONE);
+    while (1)
+    {
+        for (n = 0; n < window; n++)
+        {
+            if (map)
+            {
+                be.src[n] = map + map_pos;
+                be.src_len[n] = map_size - map_pos;
+                if (be.src_len[n] > block_size)
+                    be.src_len[n] = block_size;
+                map_pos += be.src_len[n];
+            }
+            else
+                be.src_len[n] = safe_read(fd_src, be.src[n], block_size);
+
+            if (!be.src_len[n])
+                break;
+        }
+
+        if (!n)
+            break;
+
+        workqueue_run(n_threads, n, compress_block_job, &be);
+        if (be.error)
+        {
+            perror("lzw_new_context");
+            goto end_compress_blocks;
+        }
+
+        /* i blocchi si scrivono in ordine, l'output non dipende da n_threads */
+        table = realloc(table, (n_blocks + n) * sizeof(block_entry));
+        if (!table)
+        {
+            perror("realloc");
+            exit(1);
+        }
+
+        for (i = 0; i < n; i++, n_blocks++)
+        {
+            table[n_blocks].offset = offset;
+            table[n_blocks].csize  = (uint32_t)be.dst_len[i];
+            table[n_blocks].usize  = (uint32_t)be.src_len[i];
+
+            safe_pwrite(fd_dst, be.dst[i], be.dst_len[i], offset);
+            offset += be.dst_len[i];
+            free(be.dst[i]);
+            be.dst[i] = NULL;
+        }
+
+        if (n < window)
+            break;
+    }
+
+    /* file cresciuto durante la lettura: tabella in coda */
+    if (n_blocks > n_reserved)
+        table_offset = offset;
+
+    block_write_header(fd_dst, be.ctxs[0]->code_max_bits, lzw_table_max_field(be.ctxs[0]),
+                       block_size, n_blocks, table_offset, table);
+    ret = 0;
+
+#ifdef USE_STATS
+    if (flags & LZW_FLAG_STATS)
+    {
+        lzw_stats st;
+        uint64_t in_bytes = 0;
+
+        /* l'ultimo blocco di ogni worker conta come reset */
+        memset(&st, 0, sizeof(st));
+        for (i = 0; i < n_threads; i++)
+            if (be.ctxs[i])
+            {
+                lzw_stats_reset(be.ctxs[i]);
+                lzw_stats_merge(&st, &be.ctxs[i]->stats);
+                in_bytes += be.ctxs[i]->in_bytes;
+            }
+        lzw_stats_print(&st, in_bytes, -1);
+    }
+#endif
+
+    end_compress_blocks:
+    phase_switch(PHASE_FREE);
+
+    for (i = 0; i < n_threads; i++)
+        lzw_context_enc_delete(be.ctxs[i]);
+    for (i = 0; i < window; i++)
+    {
+        if (!map)
+            free(be.src[i]);
+        free(be.dst[i]);
+    }
+    file_unmap(map, map_size);
+    free(be.ctxs);
+    free(be.src);
+    free(be.src_len);
+    free(be.dst);
+    free(be.dst_len);
+    free(table);
+
+    safe_close(fd_src);
+    safe_close(fd_dst);
+
+    phase_switch(phase);
     return ret;
 }
+
+int compress_lzw_blocks_fd(int fd_src, int fd_dst, uint8_t ratio, uint32_t reset,
+                           uint32_t n_threads, uint32_t flags)
+{
+    return compress_lzw_seekable_fd(fd_src, fd_dst, ratio, reset, n_threads,
+                                    BLOCK_DEFAULT_SIZE, flags);
+}
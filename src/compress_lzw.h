@@ -1,7 +1,51 @@
 #ifndef _COMPRESS_LZW_H_
 #define _COMPRESS_LZW_H_
 #include <stdint.h> 
+#include <stddef.h>
+
+/* dictionary reset policy: when the table is full (default), at a fixed
+   table size between 512 and the code space, or adaptive (a CLEAR code is
+   sent when the bits per input byte get worse with a full table) */
+#define LZW_RESET_FULL      0
+#define LZW_RESET_ADAPTIVE  UINT32_MAX
+#define LZW_RESET_MIN       512
 
 int compress_lzw(const char *, const char *, uint8_t);
 
+/* compress independent blocks on n_threads threads (multi-block container) */
+int compress_lzw_blocks(const char *, const char *, uint8_t, uint32_t);
+
+/* same as above on open fds (stdin, stdout, pipes...) with a reset policy,
+   the fds are closed, flags are LZW_FLAG_* (shared.h) */
+int compress_lzw_fd(int, int, uint8_t, uint32_t, uint32_t);
+int compress_lzw_blocks_fd(int, int, uint8_t, uint32_t, uint32_t, uint32_t);
+
+/* compress_lzw_blocks_fd with blocks of block_size bytes (16 KiB..256 MiB):
+   a restart point every block_size bytes of input for range decompression,
+   see decompress_lzw_range_fd */
+int compress_lzw_seekable_fd(int, int, uint8_t, uint32_t, uint32_t, uint32_t, uint32_t);
+
+/* compress_lzw_fd for many files in a row: *ctx is allocated by the first
+   call (NULL) and its tables are reused by the next ones with the same
+   ratio and reset; no messages on stdout */
+struct lzw_context_enc;
+int  compress_lzw_ctx_fd(struct lzw_context_enc **, int, int, uint8_t, uint32_t, uint32_t);
+void compress_lzw_ctx_delete(struct lzw_context_enc *);
+
+/* compress src_len bytes of src in dst, *dst_len is the size of dst on
+   input and the compressed size on output, reentrant */
+int    compress_lzw_mem(const uint8_t *, size_t, uint8_t *, size_t *, uint8_t);
+
+/* worst case compressed size for compress_lzw_mem */
+size_t compress_lzw_bound(size_t, uint8_t);
+
+/* push compression: update codes what fits of *src_len bytes and writes up
+   to *dst_len bytes, both updated with the bytes consumed and produced;
+   finish ends the stream and returns 1 while output is still pending */
+struct lzw_context_enc *compress_lzw_push_new(uint8_t);
+int  compress_lzw_push_update(struct lzw_context_enc *, const uint8_t *, size_t *,
+                              uint8_t *, size_t *);
+int  compress_lzw_push_finish(struct lzw_context_enc *, uint8_t *, size_t *);
+void compress_lzw_push_delete(struct lzw_context_enc *);
+
 #endif
@@ -0,0 +1,126 @@
+#include "dataroller.h"
+#include "compress_lzw.h"
+#include "decompress_lzw.h"
+#include "shared.h"
+
+struct dataroller_stream
+{
+    struct lzw_context_enc *enc;
+    struct lzw_push_dec    *dec;
+};
+
+size_t dataroller_compress_bound(size_t src_len, int level)
+{
+    if (level < DATAROLLER_LEVEL_MIN || level > DATAROLLER_LEVEL_MAX)
+        level = DATAROLLER_LEVEL_MAX;
+
+    return compress_lzw_bound(src_len, (uint8_t)level);
+}
+
+int dataroller_compress(const void *src, size_t src_len,
+                        void *dst, size_t *dst_len, int level)
+{
+    if ((!src && src_len) || !dst || !dst_len ||
+        level < DATAROLLER_LEVEL_MIN || level > DATAROLLER_LEVEL_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return compress_lzw_mem(src, src_len, dst, dst_len, (uint8_t)level);
+}
+
+int dataroller_decompress(const void *src, size_t src_len,
+                          void *dst, size_t *dst_len)
+{
+    if (!src || !dst || !dst_len)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return decompress_lzw_mem(src, src_len, dst, dst_len);
+}
+
+dataroller_stream *dataroller_compress_init(int level)
+{
+    dataroller_stream *s;
+
+    if (level < DATAROLLER_LEVEL_MIN || level > DATAROLLER_LEVEL_MAX)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (!(s = calloc(1, sizeof(dataroller_stream))))
+        return NULL;
+
+    if (!(s->enc = compress_lzw_push_new((uint8_t)level)))
+    {
+        free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+dataroller_stream *dataroller_decompress_init(void)
+{
+    dataroller_stream *s;
+
+    if (!(s = calloc(1, sizeof(dataroller_stream))))
+        return NULL;
+
+    if (!(s->dec = decompress_lzw_push_new()))
+    {
+        free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+int dataroller_compress_update(dataroller_stream *s, const void *src, size_t *src_len,
+                               void *dst, size_t *dst_len)
+{
+    if (!s || !s->enc || !src_len || (!src && *src_len) || !dst_len || (!dst && *dst_len))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return compress_lzw_push_update(s->enc, src, src_len, dst, dst_len);
+}
+
+int dataroller_compress_finish(dataroller_stream *s, void *dst, size_t *dst_len)
+{
+    if (!s || !s->enc || !dst_len || (!dst && *dst_len))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return compress_lzw_push_finish(s->enc, dst, dst_len);
+}
+
+int dataroller_decompress_update(dataroller_stream *s, const void *src, size_t *src_len,
+                                 void *dst, size_t *dst_len)
+{
+    if (!s || !s->dec || !src_len || (!src && *src_len) || !dst_len || (!dst && *dst_len))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return decompress_lzw_push_update(s->dec, src, src_len, dst, dst_len);
+}
+
+void dataroller_stream_free(dataroller_stream *s)
+{
+    if (s)
+    {
+        compress_lzw_push_delete(s->enc);
+        decompress_lzw_push_delete(s->dec);
+        free(s);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef _DATAROLLER_H_
+#define _DATAROLLER_H_
+
+/* libdataroller: reentrant in-memory LZW codec. calls and streams are
+   independent and can run at the same time on different threads; the
+   per-phase timing counters and the dictionary allocation policy (huge
+   pages, mlock) are process-wide and shared by all of them */
+
+#include <stddef.h>            /* size_t */
+
+#define DATAROLLER_VERSION    "0.1.4"
+
+#define DATAROLLER_LEVEL_MIN      0
+#define DATAROLLER_LEVEL_MAX     14
+#define DATAROLLER_LEVEL_DEFAULT 10
+
+/* worst case compressed size of src_len bytes at the given level */
+size_t dataroller_compress_bound(size_t src_len, int level);
+
+/* compress src_len bytes of src in dst.
+   *dst_len is the size of dst on input and the compressed size on output.
+   returns 0, or -1 with errno EINVAL (bad level) or ENOSPC (dst too small) */
+int dataroller_compress(const void *src, size_t src_len,
+                        void *dst, size_t *dst_len, int level);
+
+/* decompress src_len bytes of src in dst.
+   *dst_len is the size of dst on input and the decompressed size on output.
+   returns 0, or -1 with errno EINVAL (not a valid stream) or ENOSPC */
+int dataroller_decompress(const void *src, size_t src_len,
+                          void *dst, size_t *dst_len);
+
+/* streaming: the buffers can be passed in pieces of any size.
+   update consumes up to *src_len bytes of src and writes up to *dst_len bytes
+   in dst, both are updated with the bytes consumed and produced; bytes not
+   consumed must be passed again. memory use does not depend on the size of
+   the stream */
+typedef struct dataroller_stream dataroller_stream;
+
+/* NULL with errno EINVAL (bad level) or ENOMEM */
+dataroller_stream *dataroller_compress_init(int level);
+dataroller_stream *dataroller_decompress_init(void);
+
+/* returns 0, or -1 with errno set */
+int dataroller_compress_update(dataroller_stream *, const void *src, size_t *src_len,
+                               void *dst, size_t *dst_len);
+
+/* ends the stream; returns 1 while output is pending (call it again with
+   more room), 0 when the stream is complete, -1 on error */
+int dataroller_compress_finish(dataroller_stream *, void *dst, size_t *dst_len);
+
+/* returns 1 once the whole stream has been decoded and delivered, 0 while
+   more input or output room is needed, -1 with errno EINVAL on a bad stream */
+int dataroller_decompress_update(dataroller_stream *, const void *src, size_t *src_len,
+                                 void *dst, size_t *dst_len);
+
+void dataroller_stream_free(dataroller_stream *);
+
+#endif /* _DATAROLLER_H_ */
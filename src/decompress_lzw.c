@@ -1,11 +1,19 @@
 #include "decompress_lzw.h"
+#include "block_lzw.h"
 #include "bitio.h"
+#include "checksum.h"
+#include "iothread.h"
+#include "workqueue.h"
+#include "file.h"
+#include "phase.h"
+#include "table_alloc.h"
 #include "shared.h"
 
 #define CODE_MIN_MAX_BITS  12
 #define CODE_MAX_MAX_BITS  26
 
 #define LZW_CODE_EMPTY    256
+#define LZW_CODE_CLEAR    256 /* solo con LZW_TABLE_CLEAR */
 #define LZW_CODE_EOF      257
 #define LZW_CODE_START    258
 
@@ -31,18 +39,40 @@ static const uint32_t table_sizes[15] =
 };
 
 #define WR_BUFFER_SIZE  8192
+#define WR_MAP_SIZE     (64 << 20) /* finestra di output mappata */
+#define PUSH_INPUT_MAX  (64 << 10) /* input in sospeso nel decoder push */
 
 #define HEADER_MAGIC     0x00575a4c /* ZWL */
 
+/* corse di un byte ripetuto: i code della catena c, cc, ccc... lunga
+   almeno RUN_MIN si scrivono con un memset invece di risalire la tabella */
+#define RUN_MIN          32
+
+/* catena dei code di c, cc, ccc... nella tabella corrente */
+typedef struct lzw_run
+{
+    uint32_t top;            /* code della stringa più lunga */
+    uint32_t len;
+    uint32_t gen;            /* diversa da run_gen: solo c, dopo un reset */
+} lzw_run;
+
 typedef struct lzw_context_dec
 {
     uint32_t*      table_parent;
     uint8_t*       table_symbol;
     FILE*          f_dst;
+    struct iothread* io_dst; /* scritture su un thread, LZW_FLAG_PIPELINE */
     struct bitio*  b_src;
 
     uint8_t  code_max_bits;
-    uint32_t code_max, table_size, table_max;
+    uint32_t code_max, table_size, table_max; /* table_max 0: mai */
+    bool     clear;          /* reset con LZW_CODE_CLEAR */
+    bool     checksum;       /* crc32c dell'output dopo il codice di EOF */
+    bool     plain;          /* codici a larghezza piena invece che troncati */
+    bool     stored;         /* segmenti memorizzati dopo i codici di EOF */
+    bool     segment_end;    /* letto l'EOF, manca la lunghezza del segmento */
+    uint64_t stored_left;    /* byte del segmento memorizzato da copiare */
+    uint32_t crc, crc_stored; /* dei buffer già svuotati, e quello dello stream */
 
     uint8_t  current_code_bits;
     uint32_t current_max_code;
@@ -52,23 +82,58 @@ typedef struct lzw_context_dec
     uint32_t cnt_code;
 
     uint32_t truncate_code;
+    lzw_run  runs[256];
+    uint32_t run_gen;
+    bool     push;           /* input ed output a pezzi, vedi lzw_decode_ready */
 
     int      cnt_stack;
     uint8_t *stack_buffer, *stack;
+
+    uint8_t *wr_buffer;      /* output, svuotato su f_dst o io_dst se presenti */
+    int32_t  wr_buffer_pos, wr_buffer_size;
+    int32_t  wr_buffer_read; /* push: byte già consegnati al chiamante */
+    bool     wr_buffer_own;
+    bool     wr_buffer_map;  /* finestra mappata di fd_map a map_offset */
+    int      fd_map;
+    uint64_t map_offset;
+    bool     range;          /* si scrive solo un intervallo dell'output */
+    uint64_t range_skip, range_left;
 } lzw_context_dec;
 
+/* chiude input ed output, le tabelle restano per lo stream successivo */
+static void lzw_context_dec_close(lzw_context_dec *ctx)
+{
+    if (ctx->f_dst)
+        fclose(ctx->f_dst);
+    if (ctx->io_dst) /* wr_buffer è un suo buffer */
+        iothread_close(ctx->io_dst);
+    if (ctx->b_src)
+        bitio_close(ctx->b_src);
+    if (ctx->wr_buffer_own)
+        free(ctx->wr_buffer);
+    if (ctx->wr_buffer_map)
+    {
+        file_unmap(ctx->wr_buffer, ctx->wr_buffer_size);
+        safe_close(ctx->fd_map);
+    }
+
+    ctx->f_dst = NULL;
+    ctx->io_dst = NULL;
+    ctx->b_src = NULL;
+    ctx->wr_buffer = NULL;
+    ctx->wr_buffer_pos = ctx->wr_buffer_size = 0;
+    ctx->wr_buffer_own = ctx->wr_buffer_map = false;
+    ctx->map_offset = 0;
+    ctx->range = false;
+}
+
 void lzw_context_dec_delete(lzw_context_dec *ctx)
 {
     if (ctx)
     {
-        if (ctx->f_dst)
-            fclose(ctx->f_dst);
-        if (ctx->b_src)
-            bitio_close(ctx->b_src);
-        if (ctx->table_parent)
-            free(ctx->table_parent);
-        if (ctx->table_symbol)
-            free(ctx->table_symbol);
+        lzw_context_dec_close(ctx);
+        table_free(ctx->table_parent, sizeof(uint32_t) * ctx->table_size);
+        table_free(ctx->table_symbol, sizeof(uint8_t) * ctx->table_size);
         if (ctx->stack_buffer)
             free(ctx->stack_buffer);
 
@@ -85,6 +150,14 @@ static inline void lzw_context_dec_reset(lzw_context_dec *ctx)
     ctx->current_max_code  = 512;
     ctx->cnt_code = LZW_CODE_START;
     ctx->truncate_code = LZW_CODE_START;
+    ctx->old_code = LZW_CODE_EMPTY; /* il prossimo codice è un carattere */
+    ctx->segment_end = false;
+    ctx->stored_left = 0;
+    if (!++ctx->run_gen) /* le catene valgono solo per la generazione corrente */
+    {
+        memset(ctx->runs, 0, sizeof(ctx->runs));
+        ctx->run_gen = 1;
+    }
 }
 
 static inline void lzw_context_dec_extend_codes(lzw_context_dec *ctx)
@@ -93,171 +166,511 @@ static inline void lzw_context_dec_extend_codes(lzw_context_dec *ctx)
     ctx->current_max_code <<= 1;
 }
 
-lzw_context_dec *lzw_context_dec_new(const char *src_file, const char *dst_file)
+/* contesto senza file associati, usato anche per i singoli blocchi */
+lzw_context_dec *lzw_context_dec_alloc(uint8_t code_max_bits, uint32_t table_max)
 {
     lzw_context_dec *ctx = NULL;
-    uint64_t data;
-
-    if ( !(ctx = calloc(1, sizeof(struct lzw_context_dec))) ||
-         !(ctx->f_dst = fopen(dst_file, "wb")) ||
-         !(ctx->b_src = bitio_open(src_file, O_RDONLY)) )
-        goto abort_new_context_dec;
 
-    /* lettura header magic */
-    if (bitio_read(ctx->b_src, &data, 24) != 0)
-        goto abort_new_context_dec;
-    if ((uint32_t)data != HEADER_MAGIC)
+    if (code_max_bits < CODE_MIN_MAX_BITS || code_max_bits > CODE_MAX_MAX_BITS)
     {
         errno = EINVAL;
-        fprintf(stderr, "\"%s\" doesn't seem to be a valid LZW file...\n", src_file);
-        goto abort_new_context_dec;
+        return NULL;
     }
 
-    /*  lettura max bits */
-    if (bitio_read(ctx->b_src, &data, 8) != 0)
-        goto abort_new_context_dec;
-    ctx->code_max_bits = (uint8_t)data;
+    if (!(ctx = calloc(1, sizeof(struct lzw_context_dec))))
+        return NULL;
 
+    ctx->code_max_bits = code_max_bits;
     ctx->code_max = (uint32_t)(1 << ctx->code_max_bits);
     ctx->table_size = table_sizes[ctx->code_max_bits - CODE_MIN_MAX_BITS];
-    printf("* max code bits       : %d\n", ctx->code_max_bits);
+    ctx->checksum = (table_max & LZW_TABLE_CHECKSUM) != 0;
+    ctx->plain = (table_max & LZW_TABLE_PLAIN) != 0;
+    ctx->stored = (table_max & LZW_TABLE_STORED) != 0;
+    table_max &= ~(LZW_TABLE_CHECKSUM | LZW_TABLE_PLAIN | LZW_TABLE_STORED);
+    ctx->clear = (table_max & LZW_TABLE_CLEAR) != 0;
+    ctx->table_max = ctx->clear ? 0 : table_max;
 
-    if (!(ctx->table_parent = calloc(1, sizeof(uint32_t) * ctx->table_size)))
-        goto abort_new_context_dec;
-    if (!(ctx->table_symbol = calloc(1, sizeof(uint8_t) * ctx->table_size)))
-        goto abort_new_context_dec;
+    if (!ctx->clear && (table_max <= LZW_CODE_START || table_max > ctx->code_max))
+    {
+        free(ctx);
+        errno = EINVAL;
+        return NULL;
+    }
 
-    if (!(ctx->stack_buffer = calloc(1, sizeof(uint8_t) * ctx->code_max)))
-        goto abort_new_context_dec;
+    if (!(ctx->table_parent = table_alloc(sizeof(uint32_t) * ctx->table_size)))
+        goto abort_alloc_context_dec;
+    if (!(ctx->table_symbol = table_alloc(sizeof(uint8_t) * ctx->table_size)))
+        goto abort_alloc_context_dec;
 
-    ctx->table_max = (uint32_t)data;
-    /*  lettura dimensione reset tabella */
-    if (bitio_read(ctx->b_src, &data, 32) != 0)
-        goto abort_new_context_dec;
-    ctx->table_max = (uint32_t)data;
+    if (!(ctx->stack_buffer = calloc(1, sizeof(uint8_t) * ctx->code_max)))
+        goto abort_alloc_context_dec;
 
     lzw_context_dec_reset(ctx);
 
     return ctx;
 
-    abort_new_context_dec:
+    abort_alloc_context_dec:
     lzw_context_dec_delete(ctx);
 
     return NULL;
 }
 
+/* il contesto prende possesso di b_src e fd_dst anche in caso di errore */
+/* resto dell'header dopo il magic: max bits e dimensione reset tabella */
+static int lzw_read_header(struct bitio *b_src, uint8_t *code_max_bits, uint32_t *table_max)
+{
+    uint64_t data;
+
+    if (bitio_read(b_src, &data, 8) != 0)
+        return -1;
+    *code_max_bits = (uint8_t)data;
+
+    if (bitio_read(b_src, &data, 32) != 0)
+        return -1;
+    *table_max = (uint32_t)data;
+
+    return 0;
+}
+
+/* collega input ed output al contesto, che ne prende possesso anche in
+   caso di errore */
+static int lzw_context_dec_open(lzw_context_dec *ctx, struct bitio *b_src, int fd_dst, uint32_t flags)
+{
+    bool pipeline = (flags & LZW_FLAG_PIPELINE) != 0;
+
+    ctx->b_src = b_src;
+    ctx->crc = 0;
+
+    /* l'header è già letto, il resto dello stream si legge in anticipo */
+    if (pipeline && bitio_async(b_src))
+        perror("bitio_async");
+
+    /* output mappato a finestre, la dimensione finale non è nota */
+    if ((flags & LZW_FLAG_MMAP) &&
+        (ctx->wr_buffer = file_map_write(fd_dst, 0, WR_MAP_SIZE)))
+    {
+        ctx->wr_buffer_size = WR_MAP_SIZE;
+        ctx->wr_buffer_map = true;
+        ctx->fd_map = fd_dst;
+        return 0;
+    }
+    else if (flags & LZW_FLAG_MMAP)
+        fprintf(stderr, "mmap not available on output, using write\n");
+
+    /* si decodifica direttamente nei buffer del thread di scrittura */
+    if (pipeline &&
+        (ctx->io_dst = iothread_open(fd_dst, O_WRONLY, IOTHREAD_BUFFERS, IOTHREAD_BUFFER_SIZE)))
+    {
+        ctx->wr_buffer = iothread_write_buf(ctx->io_dst);
+        ctx->wr_buffer_size = iothread_size(ctx->io_dst);
+        return 0;
+    }
+    else if (pipeline)
+        perror("iothread_open");
+
+    if (!(ctx->f_dst = fdopen(fd_dst, "wb")))
+    {
+        safe_close(fd_dst);
+        return -1;
+    }
+
+    ctx->wr_buffer_size = WR_BUFFER_SIZE;
+    ctx->wr_buffer_own = true;
+    if (!(ctx->wr_buffer = malloc(WR_BUFFER_SIZE)))
+        return -1;
+
+    return 0;
+}
+
+lzw_context_dec *lzw_context_dec_new(struct bitio *b_src, int fd_dst, uint32_t flags)
+{
+    lzw_context_dec *ctx = NULL;
+    uint8_t code_max_bits;
+    uint32_t table_max;
+
+    if (lzw_read_header(b_src, &code_max_bits, &table_max) != 0 ||
+        !(ctx = lzw_context_dec_alloc(code_max_bits, table_max)))
+    {
+        bitio_close(b_src);
+        safe_close(fd_dst);
+        return NULL;
+    }
+    if (!(flags & LZW_FLAG_QUIET))
+    {
+        printf("* max code bits       : %d\n", ctx->code_max_bits);
+        printf("* encoding            : %s\n", ctx->plain ? "standard" : "truncate bit");
+    }
+
+    if (lzw_context_dec_open(ctx, b_src, fd_dst, flags) != 0)
+    {
+        lzw_context_dec_delete(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
 static void table_insert(lzw_context_dec *ctx, int prefix_code, unsigned char symbol)
 {
+    lzw_run *run = &ctx->runs[symbol];
+
     ctx->table_parent[ctx->cnt_code] = prefix_code;
     ctx->table_symbol[ctx->cnt_code] = symbol;
+
+    if (run->gen != ctx->run_gen)
+    {
+        run->gen = ctx->run_gen;
+        run->top = symbol;
+        run->len = 1;
+    }
+    if ((uint32_t)prefix_code == run->top) /* la catena di symbol si allunga */
+    {
+        run->top = ctx->cnt_code;
+        run->len++;
+    }
+}
+
+/* fine dell'intervallo richiesto, il resto dello stream non serve */
+static inline bool range_done(const lzw_context_dec *ctx)
+{
+    return ctx->range && !ctx->range_left;
+}
+
+/* tiene all'inizio del buffer solo i byte dentro l'intervallo, ritorna quanti */
+static int32_t range_trim(lzw_context_dec *ctx)
+{
+    uint64_t count = ctx->wr_buffer_pos;
+    uint64_t skip = ctx->range_skip < count ? ctx->range_skip : count;
+
+    ctx->range_skip -= skip;
+    count -= skip;
+    if (count > ctx->range_left)
+        count = ctx->range_left;
+    ctx->range_left -= count;
+
+    if (skip && count)
+        memmove(ctx->wr_buffer, ctx->wr_buffer + skip, count);
+    return (int32_t)count;
+}
+
+/* svuota il buffer pieno, senza file di output il buffer non si svuota;
+   ritorna 1 anche a fine intervallo per fermare la decodifica */
+static int buffering_flush(lzw_context_dec *ctx)
+{
+    int ret = 1, phase = phase_switch(PHASE_OUTPUT);
+    int32_t count;
+
+    /* il crc prima di tagliare l'intervallo, è sullo stream intero */
+    if (ctx->checksum)
+        ctx->crc = checksum_crc32c(ctx->crc, ctx->wr_buffer, ctx->wr_buffer_pos);
+    count = ctx->range ? range_trim(ctx) : ctx->wr_buffer_pos;
+
+    if (ctx->range && !count)
+        ; /* tutto fuori dall'intervallo */
+    else if (ctx->f_dst)
+    {
+        if ((fwrite(ctx->wr_buffer, sizeof(char), count, ctx->f_dst)) <= 0)
+            goto end_flush;
+    }
+    else if (ctx->io_dst) /* il buffer pieno va al thread, se ne prende uno libero */
+    {
+        iothread_write_done(ctx->io_dst, count);
+        ctx->wr_buffer = iothread_write_buf(ctx->io_dst);
+    }
+    else if (ctx->wr_buffer_map) /* si passa alla finestra successiva */
+    {
+        file_unmap(ctx->wr_buffer, ctx->wr_buffer_size);
+        ctx->map_offset += ctx->wr_buffer_pos;
+        if (!(ctx->wr_buffer = file_map_write(ctx->fd_map, ctx->map_offset, ctx->wr_buffer_size)))
+        {
+            ctx->wr_buffer_map = false;
+            safe_close(ctx->fd_map);
+            goto end_flush;
+        }
+    }
+    else
+        goto end_flush;
+
+    ctx->wr_buffer_pos = 0;
+    ret = range_done(ctx);
+
+    end_flush:
+    phase_switch(phase);
+    return ret;
 }
 
-static FORCE_INLINE int buffering_write(lzw_context_dec *ctx, char *buf, int32_t *pos, unsigned char* symbol)
+static inline FORCE_INLINE int buffering_write(lzw_context_dec *ctx, uint8_t symbol)
 {
     /* se il buffer è pieno scriviamo il blocco di byte sul file decompresso. */
-    if (*pos == WR_BUFFER_SIZE)
+    if (ctx->wr_buffer_pos == ctx->wr_buffer_size && buffering_flush(ctx))
+        return 1;
+    ctx->wr_buffer[ctx->wr_buffer_pos++] = symbol;
+    return 0;
+}
+
+/* come buffering_write per count byte, per i segmenti memorizzati */
+static int buffering_write_bytes(lzw_context_dec *ctx, const uint8_t *buf, uint32_t count)
+{
+    uint32_t n;
+
+    for (; count; buf += n, count -= n)
     {
-        if ((fwrite(buf, sizeof(char), *pos, ctx->f_dst)) <= 0)
+        if (ctx->wr_buffer_pos == ctx->wr_buffer_size && buffering_flush(ctx))
             return 1;
-        *pos = 0;
+        n = ctx->wr_buffer_size - ctx->wr_buffer_pos;
+        if (n > count)
+            n = count;
+        memcpy(ctx->wr_buffer + ctx->wr_buffer_pos, buf, n);
+        ctx->wr_buffer_pos += n;
     }
-    buf[(*pos)++] = *symbol;
     return 0;
 }
 
-#ifdef USE_TRUNCATE_BIT_ENCODING
-void truncated_binary_dec(lzw_context_dec *ctx, uint64_t *data)
+/* come buffering_write per count copie di symbol, per le corse */
+static int buffering_fill(lzw_context_dec *ctx, uint8_t symbol, uint32_t count)
 {
-    uint64_t temp_data = 0;
-    uint64_t u = ctx->current_max_code - ctx->truncate_code;
+    uint32_t n;
 
-    ctx->truncate_code++;
+    for (; count; count -= n)
+    {
+        if (ctx->wr_buffer_pos == ctx->wr_buffer_size && buffering_flush(ctx))
+            return 1;
+        n = ctx->wr_buffer_size - ctx->wr_buffer_pos;
+        if (n > count)
+            n = count;
+        memset(ctx->wr_buffer + ctx->wr_buffer_pos, symbol, n);
+        ctx->wr_buffer_pos += n;
+    }
+    return 0;
+}
 
-    if (bitio_read(ctx->b_src, data, (ctx->current_code_bits-1)) != 0)
-        exit(1);
+/* legge il prossimo codice con un solo peek/consume, ritorna 1 se l'input
+   non basta ancora (fine file, o in push l'input arrivato finora) */
+static inline FORCE_INLINE int truncated_binary_dec(lzw_context_dec *ctx, struct bitio_rd *rd,
+                                                    uint64_t *data)
+{
+    uint64_t v;
+    uint64_t u = ctx->current_max_code - ctx->truncate_code;
+    uint8_t  n = ctx->current_code_bits;
 
-    if (*data < u)
-        return;
+    /* i codici corti sono i primi n-1 bit dei codici lunghi:
+       v >> 1 < u  => codice di n-1 bit, altrimenti n bit meno u */
+    if (bitio_rd_fill(rd, n))
+    {
+        v = bitio_rd_peek(rd, n);
+        if ((v >> 1) < u)
+        {
+            *data = v >> 1;
+            bitio_rd_consume(rd, n - 1);
+        }
+        else
+        {
+            *data = v - u;
+            bitio_rd_consume(rd, n);
+        }
+    }
+    /* l'ultimo codice può chiudere lo stream con n-1 bit */
+    else if (bitio_rd_fill(rd, n - 1) && (v = bitio_rd_peek(rd, n - 1)) < u)
+    {
+        *data = v;
+        bitio_rd_consume(rd, n - 1);
+    }
     else
+        return 1;
+
+    /* a dizionario pieno (reset adattivo) resta a code_max */
+    if (ctx->truncate_code < ctx->code_max)
+        ctx->truncate_code++;
+    return 0;
+}
+
+/* plain è costante nei kernel, il ramo sparisce */
+static inline FORCE_INLINE int get_code(lzw_context_dec *ctx, struct bitio_rd *rd, uint64_t* data,
+                                        const bool plain)
+{
+    if (!plain)
+        return truncated_binary_dec(ctx, rd, data);
+
+    if (!bitio_rd_fill(rd, ctx->current_code_bits))
+        return 1;
+    *data = bitio_rd_peek(rd, ctx->current_code_bits);
+    bitio_rd_consume(rd, ctx->current_code_bits);
+    return 0;
+}
+
+/* scrive la stringa di current_code risalendo la tabella, alla fine
+   current_code è il primo carattere; ritorna 1 se l'output è pieno */
+static inline FORCE_INLINE int lzw_expand(lzw_context_dec *ctx)
+{
+    lzw_run *run;
+
+    if (ctx->current_code > LZW_CODE_EOF)
     {
-        if (bitio_read(ctx->b_src, &temp_data, 1) != 0)
-            exit(1);
+        run = &ctx->runs[ctx->table_symbol[ctx->current_code]];
+        if (run->top == ctx->current_code && run->gen == ctx->run_gen && run->len >= RUN_MIN)
+        {
+            ctx->current_code = ctx->table_symbol[ctx->current_code];
+            return buffering_fill(ctx, (uint8_t)ctx->current_code, run->len);
+        }
+    }
+
+    ctx->stack = ctx->stack_buffer;
+
+    while ( ctx->current_code > LZW_CODE_EOF )
+    {
+        *(ctx->stack) = ctx->table_symbol[ctx->current_code];
+        (ctx->stack)++;
+        /* when while exits, current_code is a character */
+        ctx->current_code = ctx->table_parent[ctx->current_code];
+    }
+
+    *(ctx->stack) = ctx->current_code;
+
+    while (ctx->stack >= ctx->stack_buffer)
+    {
+        if (buffering_write(ctx, *ctx->stack))
+            return 1;
 
-        *data = (*data << 1) | temp_data;
-        *data -= u; 
+        if (ctx->stack != ctx->stack_buffer)
+            (ctx->stack)--;
+        else 
+            break;
     }
+    return 0;
 }
-#endif
 
-void FORCE_INLINE get_code(lzw_context_dec *ctx, uint64_t* data)
-{    
-#ifdef USE_TRUNCATE_BIT_ENCODING
-    truncated_binary_dec(ctx, data);
-#else
-    if (bitio_read(ctx->b_src, data, ctx->current_code_bits) != 0)
-        exit(1);
-#endif
+/* push: c'è spazio in uscita per l'espansione del prossimo codice */
+static inline FORCE_INLINE bool lzw_decode_ready(lzw_context_dec *ctx)
+{
+    return (uint32_t)(ctx->wr_buffer_size - ctx->wr_buffer_pos) > ctx->code_max;
 }
 
-/********* decompress function *********/
-int decompress_lzw(const char *src_file, const char *dst_file)
+/* segmento dopo un codice di EOF (LZW_TABLE_STORED): legge la lunghezza e
+   copia i byte memorizzati. ritorna 0 per tornare ai codici, 2 a fine
+   stream, -1 se l'input finisce o l'output è pieno; in push 1 quando serve
+   altro input o spazio in uscita, si riprende dallo stesso punto */
+static int lzw_decode_stored(lzw_context_dec *ctx, struct bitio_rd *rd)
 {
-    int ret = 0;
-    uint64_t data;
-    lzw_context_dec *ctx = NULL;
+    uint64_t word;
+    uint32_t n;
+
+    if (ctx->segment_end)
+    {
+        n = bitio_rd_pad(rd);
+        if (!bitio_rd_fill(rd, (uint8_t)(n + 64)))
+            return ctx->push ? 1 : -1;
+        bitio_rd_consume(rd, (uint8_t)n);
+        ctx->stored_left = bitio_rd_peek(rd, 64);
+        bitio_rd_consume(rd, 64);
+        ctx->segment_end = false;
 
-    static char wr_buffer[WR_BUFFER_SIZE]; /* il buffer */
-    int32_t wr_buffer_pos = 0;
+        if (!ctx->stored_left)
+            return 2;
+    }
 
-    if (!(ctx = lzw_context_dec_new(src_file, dst_file)))
+    while (ctx->stored_left)
     {
-        perror("lzw_new_context");
-        return -1;
+        if (ctx->push && !lzw_decode_ready(ctx))
+            return 1;
+        if (!bitio_rd_fill(rd, 64))
+            return ctx->push ? 1 : -1;
+
+        word = le64toh(bitio_rd_peek(rd, 64));
+        bitio_rd_consume(rd, 64);
+        n = ctx->stored_left < 8 ? (uint32_t)ctx->stored_left : 8;
+        if (buffering_write_bytes(ctx, (uint8_t*)&word, n))
+            return -1;
+        ctx->stored_left -= n;
     }
+    return 0;
+}
 
-    /* get first code. */
-    get_code(ctx,&data);
-    ctx->old_code = (uint32_t)data;
+/* fine dello stream, ritorna 0 */
+static int lzw_decode_end(lzw_context_dec *ctx, struct bitio_rd *rd)
+{
+    /* in push il crc non si legge, resta in coda all'input */
+    if (ctx->checksum && !ctx->push)
+    {
+        if (!bitio_rd_fill(rd, 32))
+            return -1;
+        ctx->crc_stored = (uint32_t)bitio_rd_peek(rd, 32);
+        bitio_rd_consume(rd, 32);
+    }
+
+    ctx->push = false; /* fine stream */
+    return 0;
+}
+
+/* decodifica i codici di ctx->b_src fino al codice di EOF, ritorna 0;
+   in push ritorna 1 quando serve altro input o spazio in uscita. un
+   kernel per codifica dei codici, vedi lzw_decode */
+static inline FORCE_INLINE int lzw_decode_codes(lzw_context_dec *ctx, struct bitio_rd *rd,
+                                                const bool plain)
+{
+    uint64_t data;
+    int ret;
 
-    wr_buffer[wr_buffer_pos++] = (char)ctx->old_code;
+    /* push: si riprende un segmento memorizzato */
+    if ((ctx->segment_end || ctx->stored_left) &&
+        (ret = lzw_decode_stored(ctx, rd)) != 0)
+        return ret == 2 ? lzw_decode_end(ctx, rd) : ret;
 
     while (1)
     {
-        get_code(ctx,&data);
+        if (ctx->push && !lzw_decode_ready(ctx))
+            return 1;
+
+        if (get_code(ctx, rd, &data, plain))
+            return ctx->push ? 1 : -1;
         ctx->new_code = (uint32_t)data;
 
         if (ctx->new_code == LZW_CODE_EOF)  /* codice fine file ricevuto */
-            break;
-        else if (ctx->new_code >= ctx->cnt_code)
-            ctx->current_code = ctx->old_code;
-        else 
-            ctx->current_code = ctx->new_code;
-
-        ctx->stack = ctx->stack_buffer;
-
-        while ( ctx->current_code > LZW_CODE_EOF )
         {
-            *(ctx->stack) = ctx->table_symbol[ctx->current_code];
-            (ctx->stack)++;
-            /* when while exits, current_code is a character */
-            ctx->current_code = ctx->table_parent[ctx->current_code];
+            if (ctx->stored)
+            {
+                /* l'EOF non conta per la codifica troncata, i codici
+                   dopo il segmento proseguono dallo stato dell'ultimo */
+                ctx->truncate_code = ctx->old_code == LZW_CODE_EMPTY ? LZW_CODE_START :
+                                     ctx->cnt_code < ctx->code_max ? ctx->cnt_code + 1 :
+                                     ctx->code_max;
+                ctx->segment_end = true;
+                if ((ret = lzw_decode_stored(ctx, rd)) == 0)
+                    continue;
+                if (ret != 2)
+                    return ret;
+            }
+            return lzw_decode_end(ctx, rd);
         }
-
-        *(ctx->stack) = ctx->current_code;
-
-        while (ctx->stack >= ctx->stack_buffer)
+        else if (ctx->new_code == LZW_CODE_CLEAR && ctx->clear &&
+                 ctx->old_code != LZW_CODE_EMPTY)
         {
-            buffering_write(ctx, wr_buffer, &wr_buffer_pos, (unsigned char*)ctx->stack);
+            lzw_context_dec_reset(ctx);
+            continue;
+        }
+        else if (ctx->old_code == LZW_CODE_EMPTY) /* first code is a character */
+        {
+            if (ctx->new_code > 0xff)
+                return -1;
 
-            if (ctx->stack != ctx->stack_buffer)
-                (ctx->stack)--;
-            else 
-                break;
+            ctx->old_code = ctx->new_code;
+            if (buffering_write(ctx, (uint8_t)ctx->old_code))
+                return -1;
+            continue;
         }
+        else if (ctx->new_code > ctx->cnt_code) /* stream corrotto */
+            return -1;
+        else if (ctx->new_code == ctx->cnt_code)
+            ctx->current_code = ctx->old_code;
+        else 
+            ctx->current_code = ctx->new_code;
 
-        if (ctx->new_code >= ctx->cnt_code) /* undefined code */
+        if (lzw_expand(ctx))
+            return -1;
+
+        if (ctx->new_code == ctx->cnt_code) /* undefined code */
         {
-            buffering_write(ctx, wr_buffer, &wr_buffer_pos, (unsigned char*) &ctx->current_code);
+            if (buffering_write(ctx, (uint8_t)ctx->current_code))
+                return -1;
         }
 
         if ( ctx->cnt_code < ctx->code_max ) /* add prev code + k to the table */
@@ -272,25 +685,725 @@ int decompress_lzw(const char *src_file, const char *dst_file)
 
         ctx->old_code = ctx->new_code; /* prev code = cur code */
 
+        if (ctx->clear && ctx->cnt_code == ctx->code_max) /* pieno fino al CLEAR */
+            continue;
+
         if (++(ctx->cnt_code) == ctx->table_max) /* resetting table */
-        {
             lzw_context_dec_reset(ctx);
-            
-#ifdef USE_TRUNCATE_BIT_ENCODING
-            truncated_binary_dec(ctx, &data);
-#else
-            if (bitio_read(ctx->b_src, &data, ctx->current_code_bits) != 0)
-                exit(1);
-#endif
-            ctx->old_code = (uint32_t)data;
-
-            buffering_write(ctx, wr_buffer, &wr_buffer_pos, (unsigned char*) &ctx->old_code); /* first code is a character */
-        }
     }
+}
+
+static int lzw_decode_truncated(lzw_context_dec *ctx, struct bitio_rd *rd)
+{
+    return lzw_decode_codes(ctx, rd, false);
+}
+
+static int lzw_decode_plain(lzw_context_dec *ctx, struct bitio_rd *rd)
+{
+    return lzw_decode_codes(ctx, rd, true);
+}
+
+static int lzw_decode(lzw_context_dec *ctx)
+{
+    struct bitio_rd rd;
+    int ret;
+
+    bitio_rd_open(ctx->b_src, &rd);
+    ret = ctx->plain ? lzw_decode_plain(ctx, &rd) : lzw_decode_truncated(ctx, &rd);
+    bitio_rd_close(&rd);
+
+    return ret;
+}
 
-    if (wr_buffer_pos && (fwrite(wr_buffer, sizeof(char), wr_buffer_pos, ctx->f_dst) <= 0)) /* scrive il resto del blocco */
+/* confronta il crc dell'output, compresi i byte ancora nel buffer, con
+   quello scritto dal encoder */
+static int lzw_verify(lzw_context_dec *ctx)
+{
+    if (!ctx->checksum ||
+        checksum_crc32c(ctx->crc, ctx->wr_buffer, ctx->wr_buffer_pos) == ctx->crc_stored)
+        return 0;
+    return -1;
+}
+
+/* decodifica lo stream intero e scrive il resto dell'output */
+static int lzw_decode_file(lzw_context_dec *ctx)
+{
+    if (lzw_decode(ctx) != 0)
+        return range_done(ctx) ? 0 : -1;
+
+    /* l'output scritto resta, come per gli stream troncati */
+    if (lzw_verify(ctx) != 0)
+    {
+        fprintf(stderr, "checksum mismatch, corrupted data\n");
+        return -1;
+    }
+
+    if (ctx->wr_buffer_map) /* il file si accorcia alla dimensione reale */
+    {
+        if (ftruncate(ctx->fd_map, ctx->map_offset + ctx->wr_buffer_pos) != 0)
+        {
+            perror("ftruncate");
+            return -1;
+        }
+    }
+    else if (ctx->wr_buffer_pos && buffering_flush(ctx) && !range_done(ctx)) /* scrive il resto del blocco */
         exit(1);
 
+    return 0;
+}
+
+/* len UINT64_MAX: tutto l'output da offset */
+static int decompress_lzw_stream(struct bitio *b_src, int fd_dst, uint32_t flags,
+                                 uint64_t offset, uint64_t len)
+{
+    int ret = 0;
+    lzw_context_dec *ctx = NULL;
+    int phase = phase_switch(PHASE_ALLOC);
+
+    if (!(ctx = lzw_context_dec_new(b_src, fd_dst, flags)))
+    {
+        perror("lzw_new_context");
+        phase_switch(phase);
+        return -1;
+    }
+
+    /* senza indice si decodifica dall'inizio fino alla fine dell'intervallo */
+    if (offset || len != UINT64_MAX)
+    {
+        if (!(flags & LZW_FLAG_QUIET))
+            printf("* seek index          : none, decoding from the start\n");
+        ctx->range = true;
+        ctx->range_skip = offset;
+        ctx->range_left = len;
+    }
+
+    phase_switch(PHASE_CODE);
+    ret = lzw_decode_file(ctx);
+
+    phase_switch(PHASE_FREE);
     lzw_context_dec_delete(ctx);
+    phase_switch(phase);
     return ret;
 }
+
+/********* memory decompression *********/
+int decompress_lzw_mem(const uint8_t *src, size_t src_len, uint8_t *dst, size_t *dst_len)
+{
+    int ret = -1;
+    uint64_t magic, max_bits, table_max;
+    lzw_context_dec *ctx = NULL;
+    struct bitio *b_src;
+
+    assert(src && dst && dst_len);
+
+    if (!(b_src = bitio_open_mem((uint8_t*)src, src_len, O_RDONLY)))
+        return -1;
+
+    /* solo stream singoli, i blocchi vanno letti con pread */
+    if (bitio_read(b_src, &magic, 24) != 0 || (uint32_t)magic != HEADER_MAGIC ||
+        bitio_read(b_src, &max_bits, 8) != 0 ||
+        bitio_read(b_src, &table_max, 32) != 0 ||
+        !(ctx = lzw_context_dec_alloc((uint8_t)max_bits, (uint32_t)table_max)))
+    {
+        bitio_close(b_src);
+        errno = EINVAL;
+        return -1;
+    }
+
+    ctx->b_src = b_src;
+    ctx->wr_buffer = dst;
+    ctx->wr_buffer_size = *dst_len > INT32_MAX ? INT32_MAX : (int32_t)*dst_len;
+
+    if (lzw_decode(ctx) != 0) /* buffer pieno o stream corrotto */
+        errno = (ctx->wr_buffer_pos == ctx->wr_buffer_size) ? ENOSPC : EINVAL;
+    else if (lzw_verify(ctx) != 0)
+        errno = EINVAL;
+    else
+    {
+        *dst_len = ctx->wr_buffer_pos;
+        ret = 0;
+    }
+
+    ctx->wr_buffer = NULL;
+    lzw_context_dec_delete(ctx);
+    return ret;
+}
+
+/********* push decompression *********/
+typedef struct lzw_push_dec
+{
+    struct bitio    *b_src;  /* input accumulato */
+    lzw_context_dec *ctx;    /* allocato quando l'header è completo */
+    bool             done;
+} lzw_push_dec;
+
+lzw_push_dec *decompress_lzw_push_new(void)
+{
+    lzw_push_dec *pd;
+
+    if (!(pd = calloc(1, sizeof(lzw_push_dec))))
+        return NULL;
+
+    if (!(pd->b_src = bitio_open_mem(NULL, 0, O_RDONLY)))
+    {
+        free(pd);
+        return NULL;
+    }
+
+    return pd;
+}
+
+static int push_read_header(lzw_push_dec *pd)
+{
+    uint64_t magic, max_bits, table_max;
+    lzw_context_dec *ctx;
+
+    bitio_read(pd->b_src, &magic, 24);
+    bitio_read(pd->b_src, &max_bits, 8);
+    bitio_read(pd->b_src, &table_max, 32);
+
+    if ((uint32_t)magic != HEADER_MAGIC ||
+        !(ctx = lzw_context_dec_alloc((uint8_t)max_bits, (uint32_t)table_max)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* spazio per l'espansione più lunga oltre al buffer normale */
+    ctx->wr_buffer_size = ctx->code_max + 1 + WR_BUFFER_SIZE;
+    ctx->wr_buffer_own = true;
+    if (!(ctx->wr_buffer = malloc(ctx->wr_buffer_size)))
+    {
+        lzw_context_dec_delete(ctx);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ctx->b_src = pd->b_src;
+    ctx->push = true;
+    pd->ctx = ctx;
+    return 0;
+}
+
+int decompress_lzw_push_update(lzw_push_dec *pd, const uint8_t *src, size_t *src_len,
+                               uint8_t *dst, size_t *dst_len)
+{
+    lzw_context_dec *ctx;
+    size_t in = 0, out = 0, n;
+    int ret;
+
+    assert(pd && src_len && dst_len && (src || !*src_len));
+
+    /* l'input si accetta fino a PUSH_INPUT_MAX in sospeso */
+    if (!pd->done && bitio_mem_pending(pd->b_src) < PUSH_INPUT_MAX)
+    {
+        in = PUSH_INPUT_MAX - bitio_mem_pending(pd->b_src);
+        if (in > *src_len)
+            in = *src_len;
+        if (in && bitio_mem_append(pd->b_src, src, in) != 0)
+            return -1;
+    }
+    *src_len = in;
+
+    if (!pd->ctx && bitio_avail(pd->b_src) >= 64 && push_read_header(pd) != 0)
+        return -1;
+
+    while ((ctx = pd->ctx))
+    {
+        /* consegna dell'output decodificato */
+        n = ctx->wr_buffer_pos - ctx->wr_buffer_read;
+        if (n > *dst_len - out)
+            n = *dst_len - out;
+        memcpy(dst + out, ctx->wr_buffer + ctx->wr_buffer_read, n);
+        out += n;
+        ctx->wr_buffer_read += n;
+
+        if (ctx->wr_buffer_read < ctx->wr_buffer_pos) /* dst pieno */
+            break;
+        ctx->wr_buffer_pos = ctx->wr_buffer_read = 0;
+
+        if (pd->done)
+            break;
+
+        if ((ret = lzw_decode(ctx)) < 0)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        else if (!ret)
+            pd->done = true;
+        else if (!ctx->wr_buffer_pos) /* serve altro input */
+            break;
+    }
+
+    *dst_len = out;
+
+    /* 1: stream finito e tutto consegnato */
+    return (pd->done && !ctx->wr_buffer_pos) ? 1 : 0;
+}
+
+void decompress_lzw_push_delete(lzw_push_dec *pd)
+{
+    if (pd)
+    {
+        if (pd->ctx) /* b_src è del contesto */
+            lzw_context_dec_delete(pd->ctx);
+        else
+            bitio_close(pd->b_src);
+        free(pd);
+    }
+}
+
+/********* block decompression *********/
+typedef struct lzw_blocks_dec
+{
+    int               fd_src, fd_dst;
+    bool              seekable;   /* fd_dst accetta pwrite */
+    uint8_t          *map;        /* fd_dst mappato, i blocchi si decodificano al loro posto */
+    uint64_t          map_size;
+    uint8_t           code_max_bits;
+    uint32_t          table_max, block_size;
+    block_entry      *table;
+    uint64_t         *dst_offset; /* offset dei blocchi nel file decompresso */
+    uint64_t          range_start, range_end; /* parte dell'output da scrivere */
+    uint32_t          first;      /* primo blocco dell'intervallo */
+    lzw_context_dec **ctxs;       /* un contesto per worker */
+    uint8_t         **src;        /* buffer compresso per worker */
+    size_t           *src_size;
+    uint8_t         **dst;        /* buffer decompresso per worker */
+    bool              error;      /* letto e scritto dai worker, con __atomic */
+} lzw_blocks_dec;
+
+static void decompress_block_job(void *arg, uint32_t job, uint32_t worker)
+{
+    lzw_blocks_dec *bd = arg;
+    lzw_context_dec *ctx = bd->ctxs[worker];
+    uint32_t block = bd->first + job;
+    block_entry *e = &bd->table[block];
+    uint64_t skip = 0, count = e->usize;
+    int phase;
+
+    if (__atomic_load_n(&bd->error, __ATOMIC_RELAXED)) /* un blocco è già fallito */
+        return;
+
+    phase = phase_switch(PHASE_ALLOC);
+    if (!ctx)
+    {
+        if (!(ctx = bd->ctxs[worker] = lzw_context_dec_alloc(bd->code_max_bits, bd->table_max)))
+        {
+            perror("lzw_new_context");
+            __atomic_store_n(&bd->error, true, __ATOMIC_RELAXED);
+            phase_switch(phase);
+            return;
+        }
+        if (!bd->map)
+        {
+            bd->dst[worker] = my_malloc((size_t)bd->block_size + 1);
+            ctx->wr_buffer = bd->dst[worker];
+            ctx->wr_buffer_size = bd->block_size;
+        }
+    }
+
+    if (bd->map)
+    {
+        ctx->wr_buffer = bd->map + bd->dst_offset[block];
+        ctx->wr_buffer_size = e->usize;
+    }
+
+    if (bd->src_size[worker] < (size_t)e->csize + 1)
+    {
+        free(bd->src[worker]);
+        bd->src_size[worker] = (size_t)e->csize + 1;
+        bd->src[worker] = my_malloc(bd->src_size[worker]);
+    }
+
+    if (safe_pread(bd->fd_src, bd->src[worker], e->csize, e->offset) != e->csize ||
+        !(ctx->b_src = bitio_open_mem(bd->src[worker], e->csize, O_RDONLY)))
+    {
+        fprintf(stderr, "truncated block %u\n", block);
+        __atomic_store_n(&bd->error, true, __ATOMIC_RELAXED);
+        phase_switch(phase);
+        return;
+    }
+
+    /* ogni blocco parte da un dizionario vuoto */
+    phase_switch(PHASE_CODE);
+    if (ctx->cnt_code != LZW_CODE_START)
+        lzw_context_dec_reset(ctx);
+    ctx->wr_buffer_pos = 0;
+    ctx->crc = 0;
+
+    if (lzw_decode(ctx) != 0 || (uint32_t)ctx->wr_buffer_pos != e->usize || lzw_verify(ctx) != 0)
+    {
+        fprintf(stderr, "corrupted block %u\n", block);
+        __atomic_store_n(&bd->error, true, __ATOMIC_RELAXED);
+        goto end_block;
+    }
+
+    /* del primo e dell'ultimo blocco dell'intervallo si scrive una parte */
+    if (bd->dst_offset[block] < bd->range_start)
+        skip = bd->range_start - bd->dst_offset[block];
+    if (bd->dst_offset[block] + count > bd->range_end)
+        count = bd->range_end - bd->dst_offset[block];
+    count -= skip;
+
+    if (bd->map)
+        ; /* già al suo posto */
+    else if (bd->seekable) /* la posizione nel file è nota, nessun ordine tra i worker */
+        safe_pwrite(bd->fd_dst, ctx->wr_buffer + skip, count,
+                    bd->dst_offset[block] + skip - bd->range_start);
+    else /* pipe: un solo worker, i blocchi arrivano in ordine */
+        safe_write(bd->fd_dst, ctx->wr_buffer + skip, count);
+
+    end_block:
+    bitio_close(ctx->b_src);
+    ctx->b_src = NULL;
+    phase_switch(phase);
+}
+
+/* dimensione dell'input senza spostarne la posizione, -1 su una pipe */
+static int src_file_size(int fd, uint64_t *size)
+{
+    off_t cur, end;
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) < 0 ||
+        (end = lseek(fd, 0, SEEK_END)) < 0 ||
+        lseek(fd, cur, SEEK_SET) < 0)
+        return -1;
+    *size = (uint64_t)end;
+    return 0;
+}
+
+/* len UINT64_MAX: tutto l'output da offset */
+static int decompress_blocks(struct bitio *b_src, int fd_dst, uint32_t n_threads, uint32_t flags,
+                             uint64_t offset, uint64_t len)
+{
+    int ret = -1;
+    uint64_t data, table_offset, file_size, size = 0;
+    uint32_t n_blocks, n_jobs, i;
+    size_t table_bytes;
+    uint8_t *table_mem = NULL;
+    lzw_blocks_dec bd;
+    struct bitio *b;
+    int phase = phase_switch(PHASE_ALLOC);
+
+    if (!n_threads)
+        n_threads = 1;
+
+    memset(&bd, 0, sizeof(bd));
+    bd.fd_dst = fd_dst;
+    bd.fd_src = bitio_fd(b_src);
+
+    if (bitio_read(b_src, &data, 8) != 0)
+        goto end_decompress_blocks;
+    bd.code_max_bits = (uint8_t)data;
+    if (bitio_read(b_src, &data, 32) != 0)
+        goto end_decompress_blocks;
+    bd.table_max = (uint32_t)data;
+    if (bitio_read(b_src, &data, 32) != 0)
+        goto end_decompress_blocks;
+    bd.block_size = (uint32_t)data;
+    if (bitio_read(b_src, &data, 32) != 0)
+        goto end_decompress_blocks;
+    n_blocks = (uint32_t)data;
+    if (bitio_read(b_src, &table_offset, 64) != 0)
+        goto end_decompress_blocks;
+
+    if (bd.code_max_bits < CODE_MIN_MAX_BITS || bd.code_max_bits > CODE_MAX_MAX_BITS)
+    {
+        fprintf(stderr, "invalid max code bits: %d\n", bd.code_max_bits);
+        goto end_decompress_blocks;
+    }
+    if (!(flags & LZW_FLAG_QUIET))
+    {
+        printf("* max code bits       : %d\n", bd.code_max_bits);
+        printf("* encoding            : %s\n",
+               (bd.table_max & LZW_TABLE_PLAIN) ? "standard" : "truncate bit");
+        printf("* blocks              : %u\n", n_blocks);
+    }
+
+    /* lettura tabella dei blocchi */
+    if (src_file_size(bd.fd_src, &file_size))
+    {
+        fprintf(stderr, "block archives can't be read from a pipe\n");
+        goto end_decompress_blocks;
+    }
+
+    /* l'header non è affidabile: la tabella deve stare nel file */
+    if (!bd.block_size || bd.block_size > BLOCK_MAX_SIZE ||
+        table_offset < BLOCK_HEADER_SIZE || table_offset > file_size)
+    {
+        fprintf(stderr, "invalid block archive header\n");
+        goto end_decompress_blocks;
+    }
+    if (n_blocks > (file_size - table_offset) / BLOCK_ENTRY_SIZE ||
+        (size_t)n_blocks >= SIZE_MAX / BLOCK_ENTRY_SIZE)
+    {
+        fprintf(stderr, "truncated block table\n");
+        goto end_decompress_blocks;
+    }
+    table_bytes = (size_t)n_blocks * BLOCK_ENTRY_SIZE;
+
+    bd.table = my_calloc((size_t)n_blocks + 1, sizeof(block_entry));
+    bd.dst_offset = my_calloc((size_t)n_blocks + 1, sizeof(uint64_t));
+    table_mem = my_malloc(table_bytes + BLOCK_ENTRY_SIZE);
+    if (safe_pread(bd.fd_src, table_mem, table_bytes, table_offset) != table_bytes)
+    {
+        fprintf(stderr, "truncated block table\n");
+        goto end_decompress_blocks;
+    }
+
+    if (!(b = bitio_open_mem(table_mem, table_bytes, O_RDONLY)))
+        goto end_decompress_blocks;
+    for (i = 0; i < n_blocks; i++)
+    {
+        bitio_read(b, &bd.table[i].offset, 64);
+        bitio_read(b, &data, 32);
+        bd.table[i].csize = (uint32_t)data;
+        bitio_read(b, &data, 32);
+        bd.table[i].usize = (uint32_t)data;
+
+        /* i blocchi stanno nel file, dopo l'header e fuori dalla tabella
+           (subito dopo l'header o in coda) */
+        if (bd.table[i].usize > bd.block_size ||
+            bd.table[i].offset < BLOCK_HEADER_SIZE || bd.table[i].offset > file_size ||
+            bd.table[i].csize > file_size - bd.table[i].offset ||
+            (bd.table[i].offset + bd.table[i].csize > table_offset &&
+             bd.table[i].offset < table_offset + table_bytes))
+        {
+            fprintf(stderr, "invalid block table\n");
+            bitio_close(b);
+            goto end_decompress_blocks;
+        }
+
+        bd.dst_offset[i] = size;
+        size += bd.table[i].usize;
+    }
+    bitio_close(b);
+
+    /* la tabella è l'indice: si decodificano solo i blocchi dell'intervallo */
+    bd.range_start = offset < size ? offset : size;
+    bd.range_end = len < size - bd.range_start ? bd.range_start + len : size;
+    while (bd.first < n_blocks &&
+           bd.dst_offset[bd.first] + bd.table[bd.first].usize <= bd.range_start)
+        bd.first++;
+    for (n_jobs = 0; bd.first + n_jobs < n_blocks &&
+                     bd.dst_offset[bd.first + n_jobs] < bd.range_end; n_jobs++)
+        ;
+    if ((offset || len != UINT64_MAX) && !(flags & LZW_FLAG_QUIET))
+        printf("* blocks in range     : %u\n", n_jobs);
+
+    /* dimensione finale nota: i worker scrivono con pwrite senza estendere il file */
+    size = bd.range_end - bd.range_start;
+    if ((bd.seekable = lseek(bd.fd_dst, 0, SEEK_CUR) >= 0) &&
+        ftruncate(bd.fd_dst, (off_t)size) != 0)
+    {
+        perror("ftruncate");
+        goto end_decompress_blocks;
+    }
+
+    if (!bd.seekable)
+        n_threads = 1;
+    else if ((flags & LZW_FLAG_MMAP) && !(bd.map = file_map_write(bd.fd_dst, 0, size)))
+        fprintf(stderr, "mmap not available on output, using pwrite\n");
+    bd.map_size = size;
+
+    bd.ctxs     = my_calloc(n_threads, sizeof(lzw_context_dec*));
+    bd.src      = my_calloc(n_threads, sizeof(uint8_t*));
+    bd.src_size = my_calloc(n_threads, sizeof(size_t));
+    bd.dst      = my_calloc(n_threads, sizeof(uint8_t*));
+
+    /* i worker contano il loro tempo */
+    phase_switch(PHASE_NONE);
+    workqueue_run(n_threads, n_jobs, decompress_block_job, &bd);
+
+    if (!bd.error)
+        ret = 0;
+
+    end_decompress_blocks:
+    phase_switch(PHASE_FREE);
+
+    for (i = 0; bd.ctxs && i < n_threads; i++)
+    {
+        if (bd.ctxs[i])
+        {
+            bd.ctxs[i]->wr_buffer = NULL;
+            lzw_context_dec_delete(bd.ctxs[i]);
+        }
+        free(bd.src[i]);
+        free(bd.dst[i]);
+    }
+    file_unmap(bd.map, bd.map_size);
+    safe_close(bd.fd_dst);
+    bitio_close(b_src);
+    free(table_mem);
+    free(bd.table);
+    free(bd.dst_offset);
+    free(bd.ctxs);
+    free(bd.src);
+    free(bd.src_size);
+    free(bd.dst);
+
+    phase_switch(phase);
+    return ret;
+}
+
+/********* decompress function *********/
+int decompress_lzw_blocks(const char *src_file, const char *dst_file, uint32_t n_threads)
+{
+    int fd_src, fd_dst;
+
+    if ((fd_src = open(src_file, O_RDONLY)) < 0)
+    {
+        perror("open");
+        return -1;
+    }
+
+    if ((fd_dst = open(dst_file, O_RDWR | O_CREAT | O_TRUNC,
+                       S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0)
+    {
+        perror("open");
+        safe_close(fd_src);
+        return -1;
+    }
+
+    return decompress_lzw_blocks_fd(fd_src, fd_dst, n_threads, 0);
+}
+
+/* len UINT64_MAX: tutto l'output da offset */
+static int decompress_fd(int fd_src, int fd_dst, uint32_t n_threads, uint32_t flags,
+                         uint64_t offset, uint64_t len)
+{
+    struct bitio *b_src;
+    uint64_t data;
+
+    if (!(b_src = bitio_fdopen(fd_src, O_RDONLY)))
+    {
+        perror("bitio_fdopen");
+        safe_close(fd_src);
+        safe_close(fd_dst);
+        return -1;
+    }
+
+    /* lettura header magic */
+    if (bitio_read(b_src, &data, 24) == 0)
+    {
+        /* uno stream singolo si decodifica solo in sequenza */
+        if ((uint32_t)data == HEADER_MAGIC)
+            return decompress_lzw_stream(b_src, fd_dst, flags, offset, len);
+        if ((uint32_t)data == HEADER_MAGIC_BLOCK)
+            return decompress_blocks(b_src, fd_dst, n_threads, flags, offset, len);
+    }
+
+    fprintf(stderr, "input doesn't seem to be a valid LZW file...\n");
+    bitio_close(b_src);
+    safe_close(fd_dst);
+    return -1;
+}
+
+int decompress_lzw_blocks_fd(int fd_src, int fd_dst, uint32_t n_threads, uint32_t flags)
+{
+    return decompress_fd(fd_src, fd_dst, n_threads, flags, 0, UINT64_MAX);
+}
+
+/* l'output mappato è per il file intero */
+int decompress_lzw_range_fd(int fd_src, int fd_dst, uint64_t offset, uint64_t len,
+                            uint32_t n_threads, uint32_t flags)
+{
+    return decompress_fd(fd_src, fd_dst, n_threads, flags & ~LZW_FLAG_MMAP, offset, len);
+}
+
+int decompress_lzw(const char *src_file, const char *dst_file)
+{
+    return decompress_lzw_blocks(src_file, dst_file, 1);
+}
+
+int decompress_lzw_fd(int fd_src, int fd_dst, uint32_t flags)
+{
+    return decompress_lzw_blocks_fd(fd_src, fd_dst, 1, flags);
+}
+
+/* come decompress_lzw_fd con il contesto di una chiamata precedente, che
+   si rialloca solo se l'header chiede un'altra tabella */
+int decompress_lzw_ctx_fd(struct lzw_context_dec **pctx, int fd_src, int fd_dst, uint32_t flags)
+{
+    lzw_context_dec *ctx = *pctx;
+    struct bitio *b_src;
+    uint64_t data;
+    uint8_t code_max_bits;
+    uint32_t table_max;
+    bool checksum, plain, stored;
+    int ret, phase;
+
+    if (!(b_src = bitio_fdopen(fd_src, O_RDONLY)))
+    {
+        perror("bitio_fdopen");
+        safe_close(fd_src);
+        safe_close(fd_dst);
+        return -1;
+    }
+
+    if (bitio_read(b_src, &data, 24) != 0 ||
+        ((uint32_t)data != HEADER_MAGIC && (uint32_t)data != HEADER_MAGIC_BLOCK))
+    {
+        fprintf(stderr, "input doesn't seem to be a valid LZW file...\n");
+        bitio_close(b_src);
+        safe_close(fd_dst);
+        return -1;
+    }
+
+    /* i blocchi hanno i loro contesti, qui in sequenza */
+    if ((uint32_t)data == HEADER_MAGIC_BLOCK)
+        return decompress_blocks(b_src, fd_dst, 1, flags, 0, UINT64_MAX);
+
+    if (lzw_read_header(b_src, &code_max_bits, &table_max) != 0)
+    {
+        bitio_close(b_src);
+        safe_close(fd_dst);
+        return -1;
+    }
+
+    /* crc, codifica e segmenti non cambiano le tabelle */
+    phase = phase_switch(PHASE_ALLOC);
+    checksum = (table_max & LZW_TABLE_CHECKSUM) != 0;
+    plain = (table_max & LZW_TABLE_PLAIN) != 0;
+    stored = (table_max & LZW_TABLE_STORED) != 0;
+    table_max &= ~(LZW_TABLE_CHECKSUM | LZW_TABLE_PLAIN | LZW_TABLE_STORED);
+    if (ctx && (ctx->code_max_bits != code_max_bits ||
+                ((table_max & LZW_TABLE_CLEAR) ? !ctx->clear : ctx->clear || ctx->table_max != table_max)))
+    {
+        lzw_context_dec_delete(ctx);
+        ctx = *pctx = NULL;
+    }
+
+    if (!ctx && !(ctx = *pctx = lzw_context_dec_alloc(code_max_bits, table_max)))
+    {
+        perror("lzw_new_context");
+        bitio_close(b_src);
+        safe_close(fd_dst);
+        phase_switch(phase);
+        return -1;
+    }
+    lzw_context_dec_reset(ctx);
+    ctx->checksum = checksum;
+    ctx->plain = plain;
+    ctx->stored = stored;
+
+    if (lzw_context_dec_open(ctx, b_src, fd_dst, flags) != 0)
+        ret = -1;
+    else
+    {
+        phase_switch(PHASE_CODE);
+        ret = lzw_decode_file(ctx);
+    }
+
+    phase_switch(PHASE_FREE);
+    lzw_context_dec_close(ctx);
+    phase_switch(phase);
+    return ret;
+}
+
+void decompress_lzw_ctx_delete(struct lzw_context_dec *ctx)
+{
+    lzw_context_dec_delete(ctx);
+}
@@ -1,6 +1,43 @@
 #ifndef _DECOMPRESS_LZW_H_
 #define _DECOMPRESS_LZW_H_
 
+#include <stdint.h>
+#include <stddef.h>
+
 int decompress_lzw(const char *, const char *);
 
+/* decompress independent blocks on n_threads threads (multi-block container) */
+int decompress_lzw_blocks(const char *, const char *, uint32_t);
+
+/* same as above on open fds (stdin, stdout, pipes...), the fds are closed,
+   flags are LZW_FLAG_* (shared.h), mmap output needs an O_RDWR fd */
+int decompress_lzw_fd(int, int, uint32_t);
+int decompress_lzw_blocks_fd(int, int, uint32_t, uint32_t);
+
+/* decompress len bytes from offset of the uncompressed data (fewer at the
+   end of it) on n_threads threads: block archives decode only the blocks
+   of the range (see compress_lzw_seekable_fd), single streams have no seek
+   index and are decoded from the start up to the end of the range */
+int decompress_lzw_range_fd(int, int, uint64_t, uint64_t, uint32_t, uint32_t);
+
+/* decompress_lzw_fd for many files in a row: *ctx is allocated by the first
+   call (NULL) and reused by the next ones, reallocated only when a file
+   asks for other table parameters; block containers are decoded in order */
+struct lzw_context_dec;
+int  decompress_lzw_ctx_fd(struct lzw_context_dec **, int, int, uint32_t);
+void decompress_lzw_ctx_delete(struct lzw_context_dec *);
+
+/* decompress a single stream of src_len bytes in dst, *dst_len is the size
+   of dst on input and the decompressed size on output, reentrant */
+int decompress_lzw_mem(const uint8_t *, size_t, uint8_t *, size_t *);
+
+/* push decompression: update takes what fits of *src_len bytes and writes up
+   to *dst_len bytes, both updated with the bytes consumed and produced;
+   returns 1 once the end of stream has been reached and delivered */
+struct lzw_push_dec;
+struct lzw_push_dec *decompress_lzw_push_new(void);
+int  decompress_lzw_push_update(struct lzw_push_dec *, const uint8_t *, size_t *,
+                                uint8_t *, size_t *);
+void decompress_lzw_push_delete(struct lzw_push_dec *);
+
 #endif
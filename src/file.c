@@ -1,6 +1,7 @@
 #include "file.h"
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 int file_size(const char *filename)
 {
@@ -47,6 +48,53 @@ bool is_dir_empty(const char *dirname)
     return true;
 }
 
+static void map_advise(void *map, size_t size)
+{
+    madvise(map, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, size, MADV_HUGEPAGE); /* solo un suggerimento, può fallire */
+#endif
+}
+
+uint8_t *file_map_read(int fd, size_t *size)
+{
+    struct stat st;
+    void *map;
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size)
+        return NULL;
+
+    if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        return NULL;
+
+    map_advise(map, st.st_size);
+    *size = st.st_size;
+    return map;
+}
+
+uint8_t *file_map_write(int fd, off_t offset, size_t size)
+{
+    void *map;
+
+    if (!size || ftruncate(fd, offset + size) != 0)
+        return NULL;
+
+    if ((map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset)) == MAP_FAILED)
+        return NULL;
+
+    map_advise(map, size);
+    return map;
+}
+
+void file_unmap(uint8_t *map, size_t size)
+{
+    if (map && munmap(map, size) != 0)
+    {
+        perror("munmap");
+        exit(1);
+    }
+}
+
 void num2human(long double n, uint16_t bconv)
 {
     const char *label[] = {"","k","M","G","T","P","E","Z","Y", 0};
@@ -10,4 +10,10 @@ int  is_dir(const char*);
 bool is_dir_empty(const char*);
 void num2human(long double, uint16_t);
 
+/* mmap backend: read maps the whole regular file (NULL if not possible),
+   write extends the file to offset + size and maps that range (O_RDWR fd) */
+uint8_t *file_map_read(int, size_t*);
+uint8_t *file_map_write(int, off_t, size_t);
+void     file_unmap(uint8_t*, size_t);
+
 #endif
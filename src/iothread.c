@@ -0,0 +1,275 @@
+#include "iothread.h"
+#include "bitio.h"
+#include "phase.h"
+#include "shared.h"
+
+#include <pthread.h>
+
+/* i buffer passano dal produttore (il thread in lettura, il codec in
+   scrittura) al consumatore sempre nello stesso ordine */
+typedef struct iothread_slot
+{
+    uint8_t *data;
+    size_t   count;            /* 0: fine del file */
+} iothread_slot;
+
+struct iothread
+{
+    int       fd;
+    mode_t    mode;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  produced, consumed;
+
+    iothread_slot *slots;
+    uint32_t  n_slots;
+    size_t    size;
+    uint32_t  prod, cons;      /* prossimo slot da riempire e da consumare */
+    uint32_t  filled;          /* slot pubblicati, compreso quello in uso al consumatore */
+    bool      held;            /* il consumatore ha in uso lo slot cons */
+    bool      stop;
+
+    uint8_t  *cur;             /* interfaccia a copia: slot corrente */
+    size_t    cur_pos, cur_count;
+    bool      eof;
+};
+
+/* attesa senza contare il tempo nelle fasi, lo conta già il thread di I/O */
+static void iothread_wait(struct iothread *io, pthread_cond_t *cond)
+{
+    int phase = phase_switch(PHASE_NONE);
+
+    pthread_cond_wait(cond, &io->lock);
+    phase_switch(phase);
+}
+
+/* NULL se il consumatore ha chiuso */
+static uint8_t *ring_produce(struct iothread *io)
+{
+    uint8_t *data = NULL;
+
+    pthread_mutex_lock(&io->lock);
+    while (io->filled == io->n_slots && !io->stop)
+        iothread_wait(io, &io->consumed);
+    if (!io->stop)
+        data = io->slots[io->prod].data;
+    pthread_mutex_unlock(&io->lock);
+
+    return data;
+}
+
+static void ring_publish(struct iothread *io, size_t count)
+{
+    pthread_mutex_lock(&io->lock);
+    io->slots[io->prod].count = count;
+    io->prod = (io->prod + 1) % io->n_slots;
+    io->filled++;
+    pthread_cond_signal(&io->produced);
+    pthread_mutex_unlock(&io->lock);
+}
+
+/* restituisce lo slot in uso e prende il successivo, la fine del file
+   resta in uso e si ritorna sempre quella */
+static uint8_t *ring_consume(struct iothread *io, size_t *count)
+{
+    iothread_slot *s;
+
+    pthread_mutex_lock(&io->lock);
+    if (io->held && io->slots[io->cons].count)
+    {
+        io->held = false;
+        io->cons = (io->cons + 1) % io->n_slots;
+        io->filled--;
+        pthread_cond_signal(&io->consumed);
+    }
+    while (!io->held && !io->filled)
+        iothread_wait(io, &io->produced);
+    io->held = true;
+    s = &io->slots[io->cons];
+    pthread_mutex_unlock(&io->lock);
+
+    *count = s->count;
+    return s->data;
+}
+
+static void *iothread_reader(void *data)
+{
+    struct iothread *io = data;
+    uint8_t *buf;
+    size_t count;
+
+    do
+    {
+        if (!(buf = ring_produce(io)))
+            break;
+        count = safe_read(io->fd, buf, io->size);
+        ring_publish(io, count);
+    }
+    while (count);
+
+    return NULL;
+}
+
+static void *iothread_writer(void *data)
+{
+    struct iothread *io = data;
+    uint8_t *buf;
+    size_t count;
+
+    while ((buf = ring_consume(io, &count)) && count)
+        safe_write(io->fd, buf, count);
+
+    return NULL;
+}
+
+struct iothread *iothread_open(int fd, mode_t mode, uint32_t n_buffers, size_t size)
+{
+    struct iothread *io;
+    uint32_t i;
+
+    if (fd < 0 || (mode != O_RDONLY && mode != O_WRONLY) || n_buffers < 2 || !size)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    io = my_calloc(1, sizeof(struct iothread));
+    io->fd = fd;
+    io->mode = mode;
+    io->n_slots = n_buffers;
+    io->size = size;
+    io->slots = my_calloc(n_buffers, sizeof(iothread_slot));
+    for (i = 0; i < n_buffers; i++)
+        io->slots[i].data = my_malloc(size);
+
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->produced, NULL);
+    pthread_cond_init(&io->consumed, NULL);
+
+    if ((errno = pthread_create(&io->thread, NULL,
+                                mode == O_RDONLY ? iothread_reader : iothread_writer, io)))
+        goto abort;
+
+    return io;
+
+    abort:
+    pthread_cond_destroy(&io->consumed);
+    pthread_cond_destroy(&io->produced);
+    pthread_mutex_destroy(&io->lock);
+    for (i = 0; i < n_buffers; i++)
+        free(io->slots[i].data);
+    free(io->slots);
+    free(io);
+    return NULL;
+}
+
+int iothread_close(struct iothread *io)
+{
+    uint32_t i;
+
+    assert(io);
+
+    if (io->mode == O_WRONLY)
+    {
+        if (io->cur && io->cur_pos)
+            iothread_write_done(io, io->cur_pos);
+        ring_produce(io);
+        ring_publish(io, 0); /* il thread scrive il resto ed esce */
+    }
+    else
+    {
+        pthread_mutex_lock(&io->lock);
+        io->stop = true;
+        pthread_cond_signal(&io->consumed);
+        pthread_mutex_unlock(&io->lock);
+    }
+
+    pthread_join(io->thread, NULL);
+    safe_close(io->fd);
+
+    pthread_cond_destroy(&io->consumed);
+    pthread_cond_destroy(&io->produced);
+    pthread_mutex_destroy(&io->lock);
+    for (i = 0; i < io->n_slots; i++)
+        free(io->slots[i].data);
+    free(io->slots);
+    free(io);
+
+    return 0;
+}
+
+size_t iothread_size(struct iothread *io)
+{
+    return io->size;
+}
+
+uint8_t *iothread_read_buf(struct iothread *io, size_t *count)
+{
+    assert(io->mode == O_RDONLY);
+    return ring_consume(io, count);
+}
+
+uint8_t *iothread_write_buf(struct iothread *io)
+{
+    assert(io->mode == O_WRONLY);
+    return ring_produce(io);
+}
+
+void iothread_write_done(struct iothread *io, size_t count)
+{
+    /* 0 è la fine del file, lo manda solo iothread_close */
+    if (count)
+        ring_publish(io, count);
+    io->cur = NULL;
+    io->cur_pos = 0;
+}
+
+size_t iothread_read(struct iothread *io, uint8_t *buf, size_t count)
+{
+    size_t done = 0, n;
+
+    while (done < count && !io->eof)
+    {
+        if (io->cur_pos == io->cur_count)
+        {
+            io->cur = iothread_read_buf(io, &io->cur_count);
+            io->cur_pos = 0;
+            io->eof = !io->cur_count;
+            continue;
+        }
+
+        n = io->cur_count - io->cur_pos;
+        if (n > count - done)
+            n = count - done;
+        memcpy(buf + done, io->cur + io->cur_pos, n);
+        io->cur_pos += n;
+        done += n;
+    }
+
+    return done;
+}
+
+void iothread_write(struct iothread *io, const uint8_t *buf, size_t count)
+{
+    size_t n;
+
+    while (count)
+    {
+        if (!io->cur)
+        {
+            io->cur = iothread_write_buf(io);
+            io->cur_pos = 0;
+        }
+
+        n = io->size - io->cur_pos;
+        if (n > count)
+            n = count;
+        memcpy(io->cur + io->cur_pos, buf, n);
+        io->cur_pos += n;
+        buf += n;
+        count -= n;
+
+        if (io->cur_pos == io->size)
+            iothread_write_done(io, io->size);
+    }
+}
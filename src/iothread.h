@@ -0,0 +1,40 @@
+#ifndef _IOTHREAD_H_
+#define _IOTHREAD_H_
+
+#include <fcntl.h>             /* mode_t */
+#include <stdint.h>
+#include <stddef.h>
+
+/* a thread doing the reads (O_RDONLY) or the writes (O_WRONLY) of an fd,
+   exchanging a ring of buffers with the codec thread: reads go ahead of
+   the codec and writes go on while it works. the fd is closed by
+   iothread_close, read and write errors exit as in safe_read/safe_write */
+struct iothread;
+
+/* ring used by the streams: double buffering with some slack */
+#define IOTHREAD_BUFFERS      4
+#define IOTHREAD_BUFFER_SIZE  (256 << 10)
+
+/* n_buffers buffers of size bytes each, NULL if the thread can't start */
+struct iothread* iothread_open(int fd, mode_t mode, uint32_t n_buffers, size_t size);
+
+/* writes the pending buffers, stops the thread and closes the fd */
+int      iothread_close(struct iothread *io);
+
+/* bytes of a buffer */
+size_t   iothread_size(struct iothread *io);
+
+/* read: the next buffer read from the fd and its bytes in *count (0 at end
+   of file), it belongs to the caller until the next call */
+uint8_t* iothread_read_buf(struct iothread *io, size_t *count);
+
+/* write: a free buffer, filled by the caller and queued with its first
+   count bytes by iothread_write_done */
+uint8_t* iothread_write_buf(struct iothread *io);
+void     iothread_write_done(struct iothread *io, size_t count);
+
+/* copying interface: count bytes (less only at end of file) */
+size_t   iothread_read(struct iothread *io, uint8_t *buf, size_t count);
+void     iothread_write(struct iothread *io, const uint8_t *buf, size_t count);
+
+#endif
@@ -1,10 +1,19 @@
 #include <string.h>
 #include <getopt.h>
-#include <sys/mman.h> /* mlockall */
+#include <fcntl.h>    /* open */
+#include <inttypes.h> /* PRIu64 */
+#include <sys/resource.h> /* getrusage */
+#include <sys/stat.h> /* mkdir */
 
+#include "bench.h"
+#include "checksum.h"
 #include "compress_lzw.h"
 #include "decompress_lzw.h"
 #include "file.h"
+#include "multi.h"
+#include "perfctr.h"
+#include "phase.h"
+#include "table_alloc.h"
 #include "timer.h"
 
 #define ACTION_UNDEFINED  -1
@@ -12,6 +21,7 @@
 #define ACTION_DECOMPRESS  1
 
 #define DEFAULT_DECOMP_NAME "decompressed"
+#define STDIO_NAME          "-"
 
 #define PRINT_HUMAN(message, size, sec) printf("%s", message); \
                                         num2human(size, 1000); \
@@ -23,22 +33,285 @@
                                         if(sec) printf("/s");\
                                         printf(" )");
 
+static bool is_stdio(const char *filename)
+{
+    return !strcmp(filename, STDIO_NAME);
+}
+
+/* bytes with an optional k, m or g suffix, NULL if there is no number */
+static const char *parse_size(const char *s, uint64_t *size)
+{
+    char *end;
+
+    *size = strtoull(s, &end, 10);
+    switch (*end)
+    {
+        case 'k': case 'K': *size <<= 10; end++; break;
+        case 'm': case 'M': *size <<= 20; end++; break;
+        case 'g': case 'G': *size <<= 30; end++; break;
+        default: break;
+    }
+    return end == s ? NULL : end;
+}
+
+/* OFFSET:LEN, or OFFSET: up to the end */
+static int parse_range(const char *s, uint64_t *offset, uint64_t *len)
+{
+    if (!(s = parse_size(s, offset)) || *s++ != ':')
+        return -1;
+
+    *len = UINT64_MAX;
+    if (*s && (!(s = parse_size(s, len)) || *s))
+        return -1;
+    return 0;
+}
+
+/* the json report replaces the human readable messages */
+static void discard_stdout(void)
+{
+    int fd;
+
+    fflush(stdout);
+    if ((fd = open("/dev/null", O_WRONLY)) < 0 ||
+        dup2(fd, STDOUT_FILENO) < 0)
+        perror("/dev/null");
+    if (fd >= 0)
+        close(fd);
+}
+
+/* "-" is stdin/stdout, with stdout used for data messages go to stderr */
+static int open_stream(const char *filename, bool output)
+{
+    int fd;
+
+    if (is_stdio(filename))
+    {
+        if (!output)
+            return STDIN_FILENO;
+
+        fflush(stdout);
+        if ((fd = dup(STDOUT_FILENO)) < 0 ||
+            dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+            perror("dup");
+        return fd;
+    }
+
+    if (output)
+        fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, /* RDWR for mmap */
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    else
+        fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
+        perror(filename);
+    return fd;
+}
+
+/* dati della run per il report finale */
+typedef struct run_report
+{
+    const char *action;
+    const char *input;
+    const char *output;
+    int      ratio;        /* < 0 when not used */
+    uint32_t threads;
+    uint64_t in_bytes;     /* 0 when unknown (stdio) */
+    uint64_t out_bytes;
+    double   wall;
+    int      status;       /* < 0 before the (de)compression starts */
+    const perfctr *perf;   /* NULL without --perf-counters */
+    bool     multi;        /* many files: input and output are the totals */
+    uint32_t files;
+} run_report;
+
+static double tv2sec(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void json_string(FILE *f, const char *s)
+{
+    if (!s)
+    {
+        fprintf(f, "null");
+        return;
+    }
+
+    fputc('"', f);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", *s);
+        else
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void json_bytes(FILE *f, const char *key, uint64_t bytes)
+{
+    if (bytes)
+        fprintf(f, "  \"%s\": %" PRIu64 ",\n", key, bytes);
+    else
+        fprintf(f, "  \"%s\": null,\n", key);
+}
+
+/* the counters are normalized on the uncompressed size */
+static uint64_t report_plain_bytes(const run_report *rep)
+{
+    return strcmp(rep->action, "compress") ? rep->out_bytes : rep->in_bytes;
+}
+
+static void json_perf(FILE *f, const run_report *rep)
+{
+    uint64_t bytes = report_plain_bytes(rep);
+    int i;
+
+    fprintf(f, "  \"perf_counters\": {");
+    for (i = 0; i < PERFCTR_MAX; i++)
+    {
+        fprintf(f, "%s\"%s\": ", i ? ", " : "", perfctr_name(i));
+        if (perfctr_valid(rep->perf, i))
+            fprintf(f, "%" PRIu64, rep->perf->value[i]);
+        else
+            fprintf(f, "null");
+
+        fprintf(f, ", \"%s_per_byte\": ", perfctr_name(i));
+        if (perfctr_valid(rep->perf, i) && bytes)
+            fprintf(f, "%.6f", (double)rep->perf->value[i] / bytes);
+        else
+            fprintf(f, "null");
+    }
+    fprintf(f, "},\n");
+}
+
+/* report for scripts: one json object, times in seconds */
+static void report_json(FILE *f, const run_report *rep)
+{
+    struct rusage ru;
+    int i;
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    fprintf(f, "{\n  \"action\": ");
+    json_string(f, rep->action);
+    fprintf(f, ",\n  \"input\": ");
+    json_string(f, rep->input);
+    fprintf(f, ",\n  \"output\": ");
+    json_string(f, rep->output);
+    fprintf(f, ",\n");
+    if (rep->ratio >= 0)
+        fprintf(f, "  \"ratio\": %d,\n", rep->ratio);
+    fprintf(f, "  \"threads\": %u,\n", rep->threads);
+    if (rep->multi)
+        fprintf(f, "  \"files\": %u,\n", rep->files);
+    fprintf(f, "  \"status\": \"%s\",\n",
+            rep->status < 0 ? "not_started" : rep->status ? "error" : "ok");
+    json_bytes(f, "input_bytes", rep->in_bytes);
+    json_bytes(f, "output_bytes", rep->out_bytes);
+    fprintf(f, "  \"wall_seconds\": %.9f,\n", rep->wall);
+    fprintf(f, "  \"phases\": {");
+    for (i = PHASE_NONE + 1; i < PHASE_MAX; i++)
+        fprintf(f, "%s\"%s\": %.9f", i > PHASE_NONE + 1 ? ", " : "",
+                phase_name(i), phase_time(i) / 1e9);
+    fprintf(f, "},\n");
+    if (rep->perf && rep->action)
+        json_perf(f, rep);
+    fprintf(f, "  \"cpu_user_seconds\": %.6f,\n", tv2sec(ru.ru_utime));
+    fprintf(f, "  \"cpu_system_seconds\": %.6f,\n", tv2sec(ru.ru_stime));
+    fprintf(f, "  \"peak_rss_kb\": %ld,\n", ru.ru_maxrss);
+    fprintf(f, "  \"minor_faults\": %ld,\n", ru.ru_minflt);
+    fprintf(f, "  \"major_faults\": %ld\n}\n", ru.ru_majflt);
+}
+
+/* phase times and resources after the human readable summary */
+static void report_text(const run_report *rep)
+{
+    struct rusage ru;
+    uint64_t bytes;
+    int i;
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    printf("\n");
+    for (i = PHASE_NONE + 1; i < PHASE_MAX; i++)
+        printf("* time %-15s: %.6f s\n", phase_name(i), phase_time(i) / 1e9);
+    printf("* cpu user / system   : %.6f s / %.6f s\n", tv2sec(ru.ru_utime), tv2sec(ru.ru_stime));
+    printf("* peak memory         : %ld KiB\n", ru.ru_maxrss);
+    printf("* page faults         : %ld minor, %ld major\n", ru.ru_minflt, ru.ru_majflt);
+
+    if (!rep->perf)
+        return;
+
+    bytes = report_plain_bytes(rep);
+    printf("\n");
+    for (i = 0; i < PERFCTR_MAX; i++)
+    {
+        printf("* %-20s: ", perfctr_name(i));
+        if (!perfctr_valid(rep->perf, i))
+            printf("n/a\n");
+        else if (bytes)
+            printf("%" PRIu64 " ( %.4f / byte )\n", rep->perf->value[i], (double)rep->perf->value[i] / bytes);
+        else
+            printf("%" PRIu64 "\n", rep->perf->value[i]);
+    }
+    if (perfctr_valid(rep->perf, PERFCTR_CYCLES) && perfctr_valid(rep->perf, PERFCTR_INSTRUCTIONS) &&
+        rep->perf->value[PERFCTR_CYCLES])
+        printf("* instructions/cycle  : %.3f\n",
+               (double)rep->perf->value[PERFCTR_INSTRUCTIONS] / rep->perf->value[PERFCTR_CYCLES]);
+}
+
 int usage(int argc, char **argv)
 {
     fprintf(stderr, "\n"
-    "%s %s\nusage: %s [options] ...\n"
-    " -d, --decompress  <file>   : decompress file \n"
-    " -c, --compress    <file>   : compress file\n"
-    " -o, --output      <file>   : output file\n"
+    "%s %s\nusage: %s [options] ... [output_dir]\n"
+    "       %s bench [options]    : benchmark on synthetic data (bench --help)\n"
+    " -d, --decompress  <file>   : decompress file (\"-\" for stdin)\n"
+    " -c, --compress    <file>   : compress file (\"-\" for stdin)\n"
+    "                              repeated, or with a directory, the files are\n"
+    "                              (de)compressed on -t workers into output_dir,\n"
+    "                              one stream per file (no --index, --range);\n"
+    "                              inputs with the same output name fail.\n"
+    "                              empty input files are refused\n"
+    "     --files-from           : -c/-d name lists of paths, one per line\n"
+    " -o, --output      <file>   : output file (\"-\" for stdout)\n"
     " -r, --ratio       <0..14>  : select compression level\n"
+    " -t, --threads     <n>      : (de)compress independent blocks on n threads\n"
+    "     --reset       <policy> : dictionary reset: full (default), adaptive,\n"
+    "                              or the table size in codes (>= 512)\n"
+    "     --index       <size>   : seekable archive, a restart point every size\n"
+    "                              bytes of input (16k..256m, blocks on -t threads)\n"
+    "     --range   <off>:<len>  : decompress only len bytes from off (k, m, g\n"
+    "                              suffixes, no len: up to the end)\n"
     " -f, --force                : enable overwrite of files\n"
+    "     --mmap                 : map input (compress) or output (decompress)\n"
+    "     --pipeline             : reads and writes on their own threads,\n"
+    "                              overlapped with the (de)compression\n"
+    "     --checksum             : store the crc32c of the data, verified by\n"
+    "                              the decompression\n"
+    "     --encoding    <codes>  : codes written as truncate (default, smaller)\n"
+    "                              or plain (full width, faster)\n"
+    "     --store                : copy incompressible segments of the input\n"
+    "                              as they are instead of coding them\n"
+    "     --huge-pages  <policy> : huge pages for the dictionary tables: system\n"
+    "                              (default), none, thp or explicit (hugetlbfs)\n"
+    "     --mlock       <policy> : lock none (default), tables or all memory\n"
+    "     --stats                : print encoder dictionary statistics\n"
+    "     --perf-counters        : count cycles, instructions, llc, dtlb and\n"
+    "                              branch misses of the (de)compression\n"
+    "     --report      <format> : final report: text (default) or json\n"
+    "                              (json goes to stdout, to stderr with -o -)\n"
     "     --debug                : enable debug messages\n"
     "     --no-verbose           : disable verbose messages\n" /* TODO controlli di output messaggi...*/
     "\n"
     "examples: %s --decompress file.lzw .\n"
-    "          %s --ratio 5 --compress file\n",
+    "          %s --ratio 5 --compress file\n"
+    "          find . -name '*.log' | %s --files-from -c - -t 8 archive/\n"
+    "          tar c dir | %s -c - | ssh host \"%s -d - -o - | tar x\"\n",
     PACKAGE_NAME, PACKAGE_VERSION,
-    argv[0],argv[0],argv[0]);
+    argv[0],argv[0],argv[0],argv[0],argv[0],argv[0],argv[0]);
     exit(0);
 }
 
@@ -48,12 +321,33 @@ int main(int argc, char **argv)
 
     static int no_verbose_flag = 0;
     static int debug_flag = 0;
+    static int mmap_flag = 0;
+    static int pipeline_flag = 0;
+    static int checksum_flag = 0;
+    static int store_flag = 0;
+    static int stats_flag = 0;
+    static int perf_flag = 0;
+    static int files_from_flag = 0;
     int force_flag = 0;
+    bool json_flag = false;
 
     int8_t action = ACTION_UNDEFINED;
     uint8_t ratio = 10;
+    uint32_t threads = 0;
+    uint32_t reset = LZW_RESET_FULL;
+    uint64_t index_size = 0;
+    uint64_t range_offset = 0, range_len = 0;
+    bool range_flag = false;
+    bool plain_flag = false;
+    int huge_policy = TABLE_HUGE_SYSTEM, lock_policy = TABLE_LOCK_NONE;
     char *input_file = NULL, *output_file = NULL;
     char *output_dir = NULL;
+    char **inputs = NULL;   /* tutti i -c/-d, puntano in argv */
+    uint32_t n_inputs = 0;
+
+    /* sottocomando, con le politiche di memoria di default */
+    if (argc > 1 && !strcmp(argv[1], "bench"))
+        return bench_main(argc - 1, argv + 1);
 
     while (1)
     {
@@ -61,18 +355,33 @@ int main(int argc, char **argv)
         {
             {"debug",      no_argument, &debug_flag, 1},
             {"no-verbose", no_argument, &no_verbose_flag, 1},
+            {"mmap",       no_argument, &mmap_flag, 1},
+            {"pipeline",   no_argument, &pipeline_flag, 1},
+            {"checksum",   no_argument, &checksum_flag, 1},
+            {"store",      no_argument, &store_flag, 1},
+            {"stats",      no_argument, &stats_flag, 1},
+            {"perf-counters", no_argument, &perf_flag, 1},
+            {"files-from", no_argument, &files_from_flag, 1},
             {"force",      no_argument,         0, 'f'},
             {"help",       no_argument,         0, 'h'},
             {"compress",   required_argument,   0, 'c'},
             {"decompress", required_argument,   0, 'd'},
             {"output",     required_argument,   0, 'o'},
             {"ratio",      required_argument,   0, 'r'},
+            {"threads",    required_argument,   0, 't'},
+            {"reset",      required_argument,   0, 'R'},
+            {"index",      required_argument,   0, 'I'},
+            {"range",      required_argument,   0, 'G'},
+            {"encoding",   required_argument,   0, 'E'},
+            {"report",     required_argument,   0, 'J'},
+            {"huge-pages", required_argument,   0, 'H'},
+            {"mlock",      required_argument,   0, 'L'},
             {0, 0, 0, 0}
         };
 
         int option_index = 0;
  
-        opt = getopt_long (argc, argv, "hc:d:r:o:fbs",
+        opt = getopt_long (argc, argv, "hc:d:r:o:t:fbs",
                            long_options, &option_index);
  
         if (opt == -1)
@@ -89,25 +398,25 @@ int main(int argc, char **argv)
             break;
 
             case 'c':
-                 if (action != ACTION_UNDEFINED)
-                 {
-                    printf ("can't compress and decompress at the same time!\n");
-                    usage(argc,argv);
-                 }
-                action = ACTION_COMPRESS;
-                input_file = my_malloc(sizeof(char) * strlen(optarg) + 1); /*TODO check optarg*/
-                strcpy(input_file,optarg);
-            break;
-
             case 'd':
-                if (action != ACTION_UNDEFINED)
+                if (action != ACTION_UNDEFINED &&
+                    action != (opt == 'c' ? ACTION_COMPRESS : ACTION_DECOMPRESS))
                 {
                     printf ("can't compress and decompress at the same time!\n");
                     usage(argc,argv);
                 }
-                action = ACTION_DECOMPRESS;
-                input_file = my_malloc(sizeof(char) * strlen(optarg) + 1); /*TODO check optarg*/
-                strcpy(input_file,optarg);
+                action = opt == 'c' ? ACTION_COMPRESS : ACTION_DECOMPRESS;
+                if (!input_file)
+                {
+                    input_file = my_malloc(sizeof(char) * strlen(optarg) + 1); /*TODO check optarg*/
+                    strcpy(input_file,optarg);
+                }
+                if (!(inputs = realloc(inputs, (n_inputs + 1) * sizeof(char *))))
+                {
+                    perror("realloc");
+                    exit(1);
+                }
+                inputs[n_inputs++] = optarg;
             break;
 
             case 'o':
@@ -119,6 +428,72 @@ int main(int argc, char **argv)
                  ratio = atoi(optarg); /*TODO check optarg*/
             break;
 
+            case 't':
+                 threads = atoi(optarg);
+                 if (!threads)
+                     threads = sysconf(_SC_NPROCESSORS_ONLN);
+            break;
+
+            case 'R':
+                if (!strcmp(optarg, "full"))
+                    reset = LZW_RESET_FULL;
+                else if (!strcmp(optarg, "adaptive"))
+                    reset = LZW_RESET_ADAPTIVE;
+                else
+                    reset = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'I':
+                if (!parse_size(optarg, &index_size) || !index_size)
+                    usage(argc,argv);
+            break;
+
+            case 'G':
+                if (parse_range(optarg, &range_offset, &range_len) != 0)
+                    usage(argc,argv);
+                range_flag = true;
+            break;
+
+            case 'E':
+                if (!strcmp(optarg, "truncate"))
+                    plain_flag = false;
+                else if (!strcmp(optarg, "plain"))
+                    plain_flag = true;
+                else
+                    usage(argc,argv);
+            break;
+
+            case 'H':
+                if (!strcmp(optarg, "none"))
+                    huge_policy = TABLE_HUGE_NONE;
+                else if (!strcmp(optarg, "system"))
+                    huge_policy = TABLE_HUGE_SYSTEM;
+                else if (!strcmp(optarg, "thp"))
+                    huge_policy = TABLE_HUGE_THP;
+                else if (!strcmp(optarg, "explicit"))
+                    huge_policy = TABLE_HUGE_EXPLICIT;
+                else
+                    usage(argc,argv);
+            break;
+
+            case 'L':
+                if (!strcmp(optarg, "none"))
+                    lock_policy = TABLE_LOCK_NONE;
+                else if (!strcmp(optarg, "tables"))
+                    lock_policy = TABLE_LOCK_TABLES;
+                else if (!strcmp(optarg, "all"))
+                    lock_policy = TABLE_LOCK_ALL;
+                else
+                    usage(argc,argv);
+            break;
+
+            case 'J':
+                if (!strcmp(optarg, "json"))
+                    json_flag = true;
+                else if (strcmp(optarg, "text"))
+                    usage(argc,argv);
+            break;
+
             case '?':
                 usage(argc,argv);
             break;
@@ -135,7 +510,8 @@ int main(int argc, char **argv)
             output_dir = my_malloc(sizeof(char) * strlen(argv[optind]) + 3); /* TODO check */
             strcpy(output_dir,argv[optind++]);
 
-            if (!dir_exists(output_dir))
+            /* si crea l'ultimo livello, per i file multipli */
+            if (!dir_exists(output_dir) && mkdir(output_dir, 0755))
             {
                 fprintf(stderr, "output directory \"%s\" does not exists\n", output_dir);
                 free(output_dir);
@@ -154,10 +530,118 @@ int main(int argc, char **argv)
     timer tm;
     uint32_t size_a, size_b;
     double time_diff;
+    int fd_src = -1, fd_dst = -1;
+    int ret = 0;
+    uint32_t flags = 0;
+    run_report rep;
+    int report_fd = -1;
+    perfctr pc;
+
+    memset(&rep, 0, sizeof(rep));
+    rep.ratio  = -1;
+    rep.status = -1;
+    time_diff  = 0;
+
+    /* con json il testo si scarta, qui si tiene lo stdout vero */
+    if (json_flag)
+    {
+        fflush(stdout);
+        if ((report_fd = dup(STDOUT_FILENO)) < 0)
+            perror("dup");
+    }
 
-    mlockall(MCL_CURRENT | MCL_FUTURE);
+    /* senza i permessi per bloccare la memoria si continua senza */
+    table_alloc_policy(huge_policy, lock_policy);
+
+    if (mmap_flag)
+        flags |= LZW_FLAG_MMAP;
+    if (pipeline_flag)
+        flags |= LZW_FLAG_PIPELINE;
+    if (checksum_flag)
+        flags |= LZW_FLAG_CHECKSUM;
+    if (plain_flag)
+        flags |= LZW_FLAG_PLAIN;
+    if (store_flag)
+        flags |= LZW_FLAG_STORE;
+
+    /* senza permessi (perf_event_paranoid) o pmu si continua senza */
+    if (perf_flag)
+    {
+        if (!perfctr_open(&pc))
+            fprintf(stderr, "perf counters not available, see /proc/sys/kernel/perf_event_paranoid\n");
+        rep.perf = &pc;
+    }
+
+    if (stats_flag)
+    #ifdef USE_STATS
+        flags |= LZW_FLAG_STATS;
+    #else
+        fprintf(stderr, "statistics not compiled in, configure with --enable-stats\n");
+    #endif
 
-    if (input_file && !file_exists(input_file))
+    /* più file, directory o liste: un file per job sui worker */
+    if (action != ACTION_UNDEFINED &&
+        (n_inputs > 1 || files_from_flag || (input_file && is_dir(input_file))))
+    {
+        multi_opts mo;
+        multi_result mr;
+
+        /* i file sono job dei worker di -t, non a blocchi */
+        if (output_file || range_flag || index_size)
+        {
+            fprintf(stderr, "--%s is for a single file, give an output directory\n",
+                    output_file ? "output" : range_flag ? "range" : "index");
+            ret = -1;
+            goto end_main;
+        }
+
+        memset(&mo, 0, sizeof(mo));
+        mo.compress   = action == ACTION_COMPRESS;
+        mo.ratio      = ratio;
+        mo.reset      = reset;
+        mo.flags      = flags;
+        mo.workers    = threads ? threads : sysconf(_SC_NPROCESSORS_ONLN);
+        mo.force      = force_flag;
+        mo.output_dir = output_dir;
+        threads = mo.workers;
+
+        if (json_flag)
+            discard_stdout();
+        printf("* workers             : %u\n", mo.workers);
+        if (output_dir)
+        printf("* output directory    : %s\n", output_dir);
+        printf("\n\n%s.... %u path%s\n\n", mo.compress ? "compressing" : "decompressing",
+               n_inputs, n_inputs > 1 ? "s" : "");
+
+        if (rep.perf)
+            perfctr_start(&pc);
+        timer_start(&tm);
+        ret = multi_run(&mo, inputs, n_inputs, files_from_flag, &mr);
+        timer_stop(&tm);
+        if (rep.perf)
+            perfctr_stop(&pc);
+        time_diff = timer_diff(&tm);
+
+        rep.status    = ret != 0;
+        rep.multi     = true;
+        rep.files     = mr.files;
+        rep.in_bytes  = mr.in_bytes;
+        rep.out_bytes = mr.out_bytes;
+
+        printf("* files               : %u (%u failed)\n", mr.files, mr.failed);
+        printf("* elapsed time        : ");
+        time2human(time_diff);
+        if (time_diff > 0 && (mr.in_bytes || mr.out_bytes))
+        {
+            PRINT_HUMAN("* speed               : ", (double)(mo.compress ? mr.in_bytes : mr.out_bytes) / time_diff, 1);
+            printf("\n");
+        }
+        if (mo.compress && mr.in_bytes)
+            printf("* compression ratio   : %f%%\n", 100 * (1 - (double)mr.out_bytes / mr.in_bytes));
+        goto end_main;
+    }
+
+    if (input_file && !is_stdio(input_file) && !file_exists(input_file))
     {
         fprintf(stderr, "file \"%s\" does not exists!\n", input_file);
         goto end_main;
@@ -171,34 +655,43 @@ int main(int argc, char **argv)
         break;
 
         case ACTION_COMPRESS:
-            size_a = file_size(input_file);
+            /* da stdin la dimensione non è nota */
+            size_a = is_stdio(input_file) ? 0 : file_size(input_file);
 
-            if (!output_file)
+            if (!output_file && is_stdio(input_file))
+            {
+                output_file = my_malloc(sizeof(STDIO_NAME));
+                strcpy(output_file, STDIO_NAME);
+            }
+            else if (!output_file)
             {
                 output_file = my_malloc(strlen(input_file) * sizeof(char) + 5); /* TODO check strlen size ... */
                 strcpy(output_file, input_file);
                 strcpy((output_file + strlen(input_file)), ".lzw");
             }
 
-            if (output_file && !force_flag && file_exists(output_file))
+            if (output_file && !is_stdio(output_file) && !force_flag && file_exists(output_file))
             {
                 fprintf(stderr, "file \"%s\" already exists, use --force option.\n", output_file);
                 goto end_main;
             }
 
-            if (!size_a)
+            if (!size_a && !is_stdio(input_file))
             {
-                fprintf(stderr, "file \"%s\" is empty.\n", output_file);
+                fprintf(stderr, "file \"%s\" is empty.\n", input_file);
+                ret = -1;
                 goto end_main;
             }
 
+            if ((fd_dst = open_stream(output_file, true)) < 0 ||
+                (fd_src = open_stream(input_file, false)) < 0)
+                goto end_main;
+            if (json_flag)
+                discard_stdout();
+
             printf("* filename            : %s\n", input_file);
             printf("* ratio               : %d\n", ratio);
-            #ifdef USE_TRUNCATE_BIT_ENCODING
-            printf("* encoding            : truncate bit\n");
-            #else
-            printf("* encoding            : standard\n");
-            #endif
+            printf("* encoding            : %s\n", plain_flag ? "standard" : "truncate bit");
             #ifdef USE_INLINE
             printf("* inlining            : enabled\n");
             #else
@@ -206,20 +699,63 @@ int main(int argc, char **argv)
             #endif
             #ifdef USE_TRIE
             printf("* dictionary method   : trie\n");
+            #elif defined(USE_PACKED_HASH)
+            printf("* dictionary method   : hash (packed)\n");
             #else
-            printf("* dictionary method   : hash\n");
+            printf("* dictionary method   : hash (split)\n");
             #endif
 
+            if (reset == LZW_RESET_ADAPTIVE)
+            printf("* dictionary reset    : adaptive\n");
+            else if (reset != LZW_RESET_FULL)
+            printf("* dictionary reset    : every %u codes\n", reset);
+
+            if (threads)
+            {
+            printf("* threads             : %u\n", threads);
+            }
+
+            if (index_size)
+            {
+            PRINT_HUMAN("* restart interval    : ", index_size, 0);
+            printf("\n");
+            }
+
+            if (checksum_flag)
+            printf("* checksum            : crc32c (%s)\n", checksum_impl());
+
+            if (store_flag)
+            printf("* stored segments     : enabled\n");
+
+            if (size_a)
+            {
             PRINT_HUMAN("* uncompressed size   : ", size_a, 0);
+            }
 
             printf("\n\ncompressing.... \"%s\" => \"%s\" \n\n", input_file, output_file);
 
+            if (rep.perf)
+                perfctr_start(&pc);
             timer_start(&tm);
-            compress_lzw(input_file, output_file, ratio);
+            /* le funzioni chiudono i fd */
+            if (index_size)
+                ret = compress_lzw_seekable_fd(fd_src, fd_dst, ratio, reset, threads ? threads : 1,
+                                               index_size > UINT32_MAX ? UINT32_MAX : index_size, flags);
+            else if (threads)
+                ret = compress_lzw_blocks_fd(fd_src, fd_dst, ratio, reset, threads, flags);
+            else
+                ret = compress_lzw_fd(fd_src, fd_dst, ratio, reset, flags);
+            fd_src = fd_dst = -1;
             timer_stop(&tm);
+            if (rep.perf)
+                perfctr_stop(&pc);
             printf("\n* elapsed time        : ");
             time_diff = timer_diff(&tm);
             time2human(time_diff);
+            rep.status = ret != 0;
+
+            if (!size_a || is_stdio(output_file))
+                break;
 
             PRINT_HUMAN("* speed               : ", (double)size_a / time_diff, 1);
             printf("\n");
@@ -232,60 +768,87 @@ int main(int argc, char **argv)
         break;
 
         case ACTION_DECOMPRESS:
-            size_a = file_size(input_file);
+            size_a = is_stdio(input_file) ? 0 : file_size(input_file);
 
-            if (!output_file)
+            if (!output_file && is_stdio(input_file))
+            {
+                output_file = my_malloc(sizeof(STDIO_NAME));
+                strcpy(output_file, STDIO_NAME);
+            }
+            else if (!output_file)
             {
                 if ((strlen(input_file) > 4) && (strncmp((input_file + strlen(input_file) - 4) , ".lzw", 4) == 0))
                 {
-                    output_file = my_malloc(strlen(input_file) * sizeof(char) - 4);
-                    strncpy(output_file, input_file, strlen(input_file) - 4);
+                    output_file = my_malloc(strlen(input_file) * sizeof(char) - 3);
+                    memcpy(output_file, input_file, strlen(input_file) - 4);
+                    output_file[strlen(input_file) - 4] = '\0';
                 }
                 else
                 {
-                    output_file = my_malloc(strlen(DEFAULT_DECOMP_NAME) * sizeof(char));
+                    output_file = my_malloc(strlen(DEFAULT_DECOMP_NAME) * sizeof(char) + 1);
                     strcpy(output_file, DEFAULT_DECOMP_NAME);
                 }
             }
 
-            if (output_file && !force_flag && file_exists(output_file))
+            if (output_file && !is_stdio(output_file) && !force_flag && file_exists(output_file))
             {
                 fprintf(stderr, "file \"%s\" already exists, use --force option.\n", output_file);
                 goto end_main;
             }
 
-            if (!size_a)
+            if (!size_a && !is_stdio(input_file))
             {
-                fprintf(stderr, "file \"%s\" is empty.\n", output_file);
+                fprintf(stderr, "file \"%s\" is empty.\n", input_file);
+                ret = -1;
                 goto end_main;
             }
 
+            if ((fd_dst = open_stream(output_file, true)) < 0 ||
+                (fd_src = open_stream(input_file, false)) < 0)
+                goto end_main;
+            if (json_flag)
+                discard_stdout();
+
             printf("* filename            : %s\n", input_file);
-            #ifdef USE_TRUNCATE_BIT_ENCODING
-            printf("* encoding            : truncate bit\n");
-            #else
-            printf("* encoding            : standard\n");
-            #endif
             #ifdef USE_INLINE
             printf("* inlining            : enabled\n");
             #else
             printf("* inlining            : disabled\n");
             #endif
-    
+
+            if (size_a)
+            {
             PRINT_HUMAN("* compressed size     : ", size_a, 0);
+            }
 
             printf("\n\ndecompressing.... \"%s\" => \"%s\" \n\n", input_file, output_file);
+            if (rep.perf)
+                perfctr_start(&pc);
             timer_start(&tm);
-            if (decompress_lzw(input_file, output_file) != 0)
+            /* gli archivi a blocchi si decodificano in parallelo anche senza -t */
+            if (!threads)
+                threads = sysconf(_SC_NPROCESSORS_ONLN);
+            if (range_flag)
+                ret = decompress_lzw_range_fd(fd_src, fd_dst, range_offset, range_len, threads, flags);
+            else
+                ret = decompress_lzw_blocks_fd(fd_src, fd_dst, threads, flags);
+            fd_src = fd_dst = -1;
+            timer_stop(&tm);
+            if (rep.perf)
+                perfctr_stop(&pc);
+            time_diff = timer_diff(&tm);
+            rep.status = ret != 0;
+            if (ret != 0)
             {
                 printf("error, something has gone wrong...\n");
                 goto end_main;
             }
-            timer_stop(&tm);
             printf("\n* elapsed time        : ");
-            time_diff = timer_diff(&tm);
             time2human(time_diff);
 
+            if (!size_a || is_stdio(output_file))
+                break;
+
             size_b = file_size(output_file);
 
             PRINT_HUMAN("* speed               : ", (double)size_a / time_diff, 1);
@@ -298,14 +861,59 @@ int main(int argc, char **argv)
 
     end_main:
 
+    if (rep.status >= 0 || json_flag)
+    {
+        rep.action    = action == ACTION_COMPRESS ? "compress" :
+                        action == ACTION_DECOMPRESS ? "decompress" : NULL;
+        rep.input     = rep.multi ? NULL : input_file;
+        rep.output    = rep.multi ? output_dir : output_file;
+        rep.threads   = threads;
+        rep.wall      = time_diff;
+        if (action == ACTION_COMPRESS)
+            rep.ratio = ratio;
+        if (!rep.multi && rep.status >= 0 && input_file && !is_stdio(input_file))
+            rep.in_bytes = file_size(input_file);
+        if (!rep.multi && rep.status >= 0 && output_file && !is_stdio(output_file))
+            rep.out_bytes = file_size(output_file);
+    }
+
+    if (json_flag && report_fd >= 0)
+    {
+        FILE *f;
+
+        /* con i dati su stdout il report va su stderr */
+        fflush(stdout);
+        if (output_file && is_stdio(output_file))
+        {
+            close(report_fd);
+            report_fd = dup(STDERR_FILENO);
+        }
+        if ((f = fdopen(report_fd, "w")))
+        {
+            report_json(f, &rep);
+            fclose(f);
+        }
+        else
+            close(report_fd);
+    }
+    else if (rep.status == 0)
+        report_text(&rep);
+    if (rep.perf)
+        perfctr_close(&pc);
+
+    if (fd_src >= 0)
+        close(fd_src);
+    if (fd_dst >= 0)
+        close(fd_dst);
     if (output_file)
         free(output_file);
     if (input_file)
         free(input_file);
+    free(inputs);
     if (output_dir)
         free(output_dir);
 
-    return 0;
+    return ret ? 1 : 0;
 }
 
 
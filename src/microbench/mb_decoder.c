@@ -0,0 +1,124 @@
+/* kernel del decoder: si include il sorgente per misurare le stesse
+   funzioni, con gli stessi inline, del decompressore */
+#include "../decompress_lzw.c"
+#include "microbench.h"
+
+#define MB_EXPAND_OUT  (16 << 20)
+
+static inline uint64_t mb_rand(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545f4914f6cdd1dULL;
+}
+
+/* rilegge lo stream di mb_enc_truncated e confronta i codici */
+int mb_dec_truncated(const uint32_t *val, uint64_t ops, uint8_t bits,
+                     const uint8_t *buf, size_t len, mb_clock *clk)
+{
+    lzw_context_dec ctx;
+    struct bitio *b;
+    struct bitio_rd rd;
+    uint64_t data, bad = 0, i;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.current_code_bits = bits;
+    ctx.current_max_code = 1u << bits;
+    ctx.code_max = 1u << CODE_MAX_MAX_BITS;
+
+    if (!(b = bitio_open_mem((uint8_t *)buf, len, O_RDONLY)))
+        return -1;
+
+    bitio_rd_open(b, &rd);
+    mb_start(clk);
+    for (i = 0; i < ops; i++)
+    {
+        /* contatore fermo come nell'encoder */
+        ctx.truncate_code = 3u << (bits - 2);
+        if (get_code(&ctx, &rd, &data, false))
+            break;
+        bad += data != val[i];
+    }
+    mb_stop(clk);
+    bitio_rd_close(&rd);
+    bitio_close(b);
+
+    if (i != ops || bad)
+    {
+        fprintf(stderr, "truncated read at %u bits: stream mismatch\n", bits);
+        return -1;
+    }
+    return 0;
+}
+
+/* tabella a bits bit fatta di catene di len - 1 code a posizioni casuali
+   (un carattere alla radice), si espandono le ultime code delle catene */
+int mb_expand(uint8_t bits, uint32_t len, uint64_t ops, mb_clock *clk)
+{
+    lzw_context_dec *ctx;
+    uint32_t *perm = NULL, *ends = NULL, codes, chains, c, j, t, k = 0;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL, out = 0, i;
+    int ret = -1;
+
+    if (!(ctx = lzw_context_dec_alloc(bits, 1u << bits)))
+        return -1;
+
+    codes = ctx->code_max - LZW_CODE_START;
+    chains = codes / (len - 1);
+    if (!(perm = malloc(sizeof(uint32_t) * codes)) ||
+        !(ends = malloc(sizeof(uint32_t) * chains)) ||
+        !(ctx->wr_buffer = malloc(MB_EXPAND_OUT)))
+        goto abort_mb_expand;
+    ctx->wr_buffer_own = true;
+    ctx->wr_buffer_size = MB_EXPAND_OUT;
+
+    for (c = 0; c < codes; c++)
+        perm[c] = LZW_CODE_START + c;
+    for (c = codes - 1; c > 0; c--)
+    {
+        j = mb_rand(&seed) % (c + 1);
+        t = perm[c]; perm[c] = perm[j]; perm[j] = t;
+    }
+
+    for (c = 0; c < chains; c++)
+    {
+        ctx->table_parent[perm[c * (len - 1)]] = (uint8_t)mb_rand(&seed);
+        for (j = 0; j < len - 1; j++)
+        {
+            ctx->table_symbol[perm[c * (len - 1) + j]] = (uint8_t)mb_rand(&seed);
+            if (j)
+                ctx->table_parent[perm[c * (len - 1) + j]] = perm[c * (len - 1) + j - 1];
+        }
+        ends[c] = perm[c * (len - 1) + len - 2];
+    }
+
+    mb_start(clk);
+    for (i = 0; i < ops; i++)
+    {
+        /* il buffer non si svuota, si ricomincia prima che sia pieno */
+        if (ctx->wr_buffer_pos > MB_EXPAND_OUT - (int32_t)len)
+        {
+            out += ctx->wr_buffer_pos;
+            ctx->wr_buffer_pos = 0;
+        }
+        ctx->current_code = ends[k];
+        if (++k == chains)
+            k = 0;
+        if (lzw_expand(ctx))
+            break;
+    }
+    mb_stop(clk);
+    out += ctx->wr_buffer_pos;
+
+    if (i == ops && out == ops * len)
+        ret = 0;
+    else
+        fprintf(stderr, "expand %u bytes at %u bits: wrong output size\n", len, bits);
+
+    abort_mb_expand:
+        free(perm);
+        free(ends);
+        lzw_context_dec_delete(ctx);
+        return ret;
+}
@@ -0,0 +1,130 @@
+/* kernel dell'encoder: si include il sorgente per misurare le stesse
+   funzioni, con gli stessi inline, del compressore */
+#include "../compress_lzw.c"
+#include "microbench.h"
+
+typedef struct mb_pair
+{
+    uint32_t parent;
+    uint8_t  symbol;
+} mb_pair;
+
+static inline uint64_t mb_rand(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545f4914f6cdd1dULL;
+}
+
+/* codici di bits bit con il contatore della tabella a 3/4 della larghezza */
+int mb_enc_truncated(const uint32_t *val, uint64_t ops, uint8_t bits,
+                     uint8_t *buf, size_t size, size_t *len, mb_clock *clk)
+{
+    lzw_context_enc ctx;
+    struct bitio *b;
+    struct bitio_wr wr;
+    uint64_t i;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.current_code_bits = bits;
+    ctx.current_max_code = 1u << bits;
+    ctx.new_code = 3u << (bits - 2);
+
+    if (!(b = bitio_open_mem(buf, size, O_WRONLY)))
+        return -1;
+
+    bitio_wr_open(b, &wr);
+    mb_start(clk);
+    for (i = 0; i < ops; i++)
+    {
+        ctx.current_parent_code = val[i];
+        lzw_write_code(&ctx, &wr, false);
+    }
+    mb_stop(clk);
+    bitio_wr_close(&wr);
+
+    return bitio_close_mem(b, len) ? 0 : -1;
+}
+
+const char *mb_dict_name(void)
+{
+#ifdef USE_TRIE
+    return "trie_lookup";
+#else
+    return "hash_lookup";
+#endif
+}
+
+/* codice esistente a caso, i code 256 e 257 non sono nodi */
+static uint32_t mb_parent(uint64_t *s, uint32_t codes)
+{
+    uint32_t c = mb_rand(s) % (codes - 2);
+
+    return c < 256 ? c : c + 2;
+}
+
+/* dizionario pieno di coppie casuali, poi ops ricerche di cui hit_pct%
+   presenti e le altre assenti */
+int mb_dict_lookup(uint8_t ratio, uint32_t hit_pct, uint64_t ops, mb_clock *clk)
+{
+    lzw_context_enc *ctx;
+    mb_pair *pairs = NULL, *query = NULL;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL, index, found = 0, i;
+    uint32_t n = 0;
+    int ret = -1;
+
+    if (!(ctx = lzw_context_enc_alloc(ratio, LZW_RESET_FULL)))
+        return -1;
+    if (!(pairs = malloc(sizeof(mb_pair) * ctx->code_max)) ||
+        !(query = malloc(sizeof(mb_pair) * ops)))
+        goto abort_mb_dict;
+
+    /* ogni code deve esistere, le coppie già presenti si riestraggono */
+    for (ctx->new_code = LZW_CODE_START; ctx->new_code < ctx->code_max; )
+    {
+        ctx->current_parent_code = mb_parent(&seed, ctx->new_code);
+        ctx->new_symbol = (uint8_t)(mb_rand(&seed) >> 56);
+        if (dict_lookup(ctx, &index))
+            continue;
+        dict_insert(ctx, index);
+        pairs[n].parent = ctx->current_parent_code;
+        pairs[n++].symbol = ctx->new_symbol;
+        ctx->new_code++;
+    }
+
+    for (i = 0; i < ops; i++)
+    {
+        if (mb_rand(&seed) % 100 < hit_pct)
+            query[i] = pairs[mb_rand(&seed) % n];
+        else
+            do
+            {
+                ctx->current_parent_code = mb_parent(&seed, ctx->code_max);
+                ctx->new_symbol = (uint8_t)(mb_rand(&seed) >> 56);
+                query[i].parent = ctx->current_parent_code;
+                query[i].symbol = ctx->new_symbol;
+            } while (dict_lookup(ctx, &index));
+    }
+
+    mb_start(clk);
+    for (i = 0; i < ops; i++)
+    {
+        ctx->current_parent_code = query[i].parent;
+        ctx->new_symbol = query[i].symbol;
+        found += dict_lookup(ctx, &index);
+    }
+    mb_stop(clk);
+
+    /* controllo, evita anche che il ciclo sparisca */
+    if (found * 100 / ops + 2 < hit_pct || found * 100 / ops > hit_pct + 2)
+        fprintf(stderr, "%s: %" PRIu64 " hits instead of %u%%\n", mb_dict_name(), found, hit_pct);
+    else
+        ret = 0;
+
+    abort_mb_dict:
+        free(pairs);
+        free(query);
+        lzw_context_enc_delete(ctx);
+        return ret;
+}
@@ -0,0 +1,310 @@
+#include "microbench.h"
+
+#include <getopt.h>
+
+#include "../bitio.h"
+#include "../shared.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>       /* __rdtsc */
+  #define MB_TSC() __rdtsc()
+#endif
+
+#define MB_OPS        (1 << 22)
+#define MB_BITS_MIN   9
+#define MB_BITS_MAX   26
+
+static const uint32_t mb_hits[] = { 0, 50, 90, 100 };
+static const uint32_t mb_lens[] = { 2, 8, 32 };
+
+/********* clock *********/
+void mb_start(mb_clock *clk)
+{
+#ifdef MB_TSC
+    clk->start_tsc = MB_TSC();
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &clk->start);
+}
+
+void mb_stop(mb_clock *clk)
+{
+    struct timespec stop;
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+#ifdef MB_TSC
+    clk->cycles = (double)(MB_TSC() - clk->start_tsc);
+#else
+    clk->cycles = -1;
+#endif
+    clk->ns = (stop.tv_sec - clk->start.tv_sec) * 1e9 + (stop.tv_nsec - clk->start.tv_nsec);
+}
+
+static void mb_report(const char *kernel, const char *variant, uint64_t ops, const mb_clock *clk)
+{
+    printf("%-14s %-22s %10.2f ns/op", kernel, variant, clk->ns / ops);
+    if (clk->cycles >= 0)
+        printf(" %10.2f cycles/op\n", clk->cycles / ops);
+    else
+        printf(" %10s cycles/op\n", "n/a");
+    fflush(stdout);
+}
+
+static inline uint64_t mb_rand(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545f4914f6cdd1dULL;
+}
+
+/********* bitio *********/
+/* codici a larghezza fissa con il writer inline e con bitio_write */
+static int mb_write_plain(const uint32_t *val, uint64_t ops, uint8_t bits, bool api,
+                          uint8_t *buf, size_t size, size_t *len, mb_clock *clk)
+{
+    struct bitio *b;
+    struct bitio_wr wr;
+    uint64_t i;
+
+    if (!(b = bitio_open_mem(buf, size, O_WRONLY)))
+        return -1;
+
+    if (api)
+    {
+        mb_start(clk);
+        for (i = 0; i < ops; i++)
+            bitio_write(b, val[i], bits);
+        mb_stop(clk);
+    }
+    else
+    {
+        bitio_wr_open(b, &wr);
+        mb_start(clk);
+        for (i = 0; i < ops; i++)
+            bitio_wr_put(&wr, val[i], bits);
+        mb_stop(clk);
+        bitio_wr_close(&wr);
+    }
+
+    return bitio_close_mem(b, len) ? 0 : -1;
+}
+
+static int mb_read_plain(const uint32_t *val, uint64_t ops, uint8_t bits, bool api,
+                         const uint8_t *buf, size_t len, mb_clock *clk)
+{
+    struct bitio *b;
+    struct bitio_rd rd;
+    uint64_t data, bad = 0, i;
+
+    if (!(b = bitio_open_mem((uint8_t *)buf, len, O_RDONLY)))
+        return -1;
+
+    if (api)
+    {
+        mb_start(clk);
+        for (i = 0; i < ops; i++)
+        {
+            bitio_read(b, &data, bits);
+            bad += data != val[i];
+        }
+        mb_stop(clk);
+    }
+    else
+    {
+        bitio_rd_open(b, &rd);
+        mb_start(clk);
+        for (i = 0; i < ops; i++)
+        {
+            if (!bitio_rd_fill(&rd, bits))
+                break;
+            data = bitio_rd_peek(&rd, bits);
+            bitio_rd_consume(&rd, bits);
+            bad += data != val[i];
+        }
+        mb_stop(clk);
+        bitio_rd_close(&rd);
+    }
+    bitio_close(b);
+
+    if (bad || i != ops)
+    {
+        fprintf(stderr, "read at %u bits: stream mismatch\n", bits);
+        return -1;
+    }
+    return 0;
+}
+
+/* per ogni larghezza: scrittura e lettura semplici (inline e api) e con
+   truncated binary encoding */
+static int mb_bitio(uint64_t ops, bool wr, bool rd)
+{
+    uint32_t *val;
+    uint8_t *buf, bits;
+    size_t size = ops * MB_BITS_MAX / 8 + 64, len;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL, i;
+    mb_clock clk;
+    char variant[32];
+    int ret = -1;
+
+    val = my_malloc(sizeof(uint32_t) * ops);
+    buf = my_malloc(size);
+    memset(buf, 0, size);
+
+    for (bits = MB_BITS_MIN; bits <= MB_BITS_MAX; bits++)
+    {
+        /* valori sotto il contatore del truncated (3/4 dello spazio) */
+        for (i = 0; i < ops; i++)
+            val[i] = mb_rand(&seed) % (3u << (bits - 2));
+
+        if (mb_write_plain(val, ops, bits, false, buf, size, &len, &clk))
+            goto abort_mb_bitio;
+        snprintf(variant, sizeof(variant), "plain %u bits", bits);
+        if (wr)
+            mb_report("bitio_write", variant, ops, &clk);
+        if (mb_read_plain(val, ops, bits, false, buf, len, &clk))
+            goto abort_mb_bitio;
+        if (rd)
+            mb_report("bitio_read", variant, ops, &clk);
+
+        if (mb_write_plain(val, ops, bits, true, buf, size, &len, &clk))
+            goto abort_mb_bitio;
+        snprintf(variant, sizeof(variant), "api %u bits", bits);
+        if (wr)
+            mb_report("bitio_write", variant, ops, &clk);
+        if (mb_read_plain(val, ops, bits, true, buf, len, &clk))
+            goto abort_mb_bitio;
+        if (rd)
+            mb_report("bitio_read", variant, ops, &clk);
+
+        if (mb_enc_truncated(val, ops, bits, buf, size, &len, &clk))
+            goto abort_mb_bitio;
+        snprintf(variant, sizeof(variant), "truncated %u bits", bits);
+        if (wr)
+            mb_report("bitio_write", variant, ops, &clk);
+        if (mb_dec_truncated(val, ops, bits, buf, len, &clk))
+            goto abort_mb_bitio;
+        if (rd)
+            mb_report("bitio_read", variant, ops, &clk);
+    }
+    ret = 0;
+
+    abort_mb_bitio:
+        free(val);
+        free(buf);
+        return ret;
+}
+
+/********* dictionary and expansion *********/
+static int mb_dict(uint64_t ops, uint8_t bits_max)
+{
+    mb_clock clk;
+    char variant[32];
+    uint8_t bits;
+    uint32_t h;
+
+    for (bits = 12; bits <= bits_max; bits++)
+        for (h = 0; h < sizeof(mb_hits) / sizeof(mb_hits[0]); h++)
+        {
+            if (mb_dict_lookup(bits - 12, mb_hits[h], ops, &clk))
+                return -1;
+            snprintf(variant, sizeof(variant), "%u bits %u%% hit", bits, mb_hits[h]);
+            mb_report(mb_dict_name(), variant, ops, &clk);
+        }
+    return 0;
+}
+
+static int mb_expansion(uint64_t ops, uint8_t bits_max)
+{
+    mb_clock clk;
+    char variant[32];
+    uint8_t bits;
+    uint32_t l;
+
+    for (bits = 12; bits <= bits_max; bits += 4)
+        for (l = 0; l < sizeof(mb_lens) / sizeof(mb_lens[0]); l++)
+        {
+            if (mb_expand(bits, mb_lens[l], ops, &clk))
+                return -1;
+            snprintf(variant, sizeof(variant), "%u bits %u bytes", bits, mb_lens[l]);
+            mb_report("expand", variant, ops, &clk);
+        }
+    return 0;
+}
+
+static void mb_usage(const char *name)
+{
+    fprintf(stderr, "\n"
+    "usage: %s [options] [kernel ...]\n"
+    " -n, --ops         <n>      : operations per measure (default %u)\n"
+    " -b, --bits        <12..26> : largest table for lookup and expand (default 26)\n"
+    "\n"
+    "kernels: bitio_write bitio_read lookup expand (default all)\n"
+    "cycles are reference cycles (time stamp counter) where available\n",
+    name, MB_OPS);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t ops = MB_OPS;
+    uint8_t bits_max = MB_BITS_MAX;
+    bool wr = false, rd = false, lookup = false, expand = false;
+    int opt, i, ret = 0;
+
+    while (1)
+    {
+        static struct option long_options[] =
+        {
+            {"help",   no_argument,       0, 'h'},
+            {"ops",    required_argument, 0, 'n'},
+            {"bits",   required_argument, 0, 'b'},
+            {0, 0, 0, 0}
+        };
+
+        opt = getopt_long(argc, argv, "hn:b:", long_options, NULL);
+        if (opt == -1)
+            break;
+
+        switch (opt)
+        {
+            case 'n':
+                if (!(ops = strtoull(optarg, NULL, 10)))
+                    mb_usage(argv[0]);
+            break;
+
+            case 'b':
+                bits_max = atoi(optarg);
+                if (bits_max < 12 || bits_max > MB_BITS_MAX)
+                    mb_usage(argv[0]);
+            break;
+
+            default:
+                mb_usage(argv[0]);
+        }
+    }
+
+    for (i = optind; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "bitio_write"))
+            wr = true;
+        else if (!strcmp(argv[i], "bitio_read"))
+            rd = true;
+        else if (!strcmp(argv[i], "lookup"))
+            lookup = true;
+        else if (!strcmp(argv[i], "expand"))
+            expand = true;
+        else
+            mb_usage(argv[0]);
+    }
+    if (optind == argc)
+        wr = rd = lookup = expand = true;
+
+    if ((wr || rd) && mb_bitio(ops, wr, rd))
+        ret = 1;
+    if (!ret && lookup && mb_dict(ops, bits_max))
+        ret = 1;
+    if (!ret && expand && mb_expansion(ops, bits_max))
+        ret = 1;
+
+    return ret;
+}
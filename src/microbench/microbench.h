@@ -0,0 +1,31 @@
+#ifndef _MICROBENCH_H_
+#define _MICROBENCH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+/* time and (reference) cycles of one kernel loop */
+typedef struct mb_clock
+{
+    struct timespec start;
+    uint64_t start_tsc;
+    double   ns;
+    double   cycles;       /* < 0 when there is no cycle counter */
+} mb_clock;
+
+void mb_start(mb_clock *);
+void mb_stop(mb_clock *);
+
+/* encoder kernels (mb_encoder.c): truncated binary code writes at a fixed
+   width, and dictionary lookups at a table size with hit_pct% hits */
+int mb_enc_truncated(const uint32_t *, uint64_t, uint8_t, uint8_t *, size_t, size_t *, mb_clock *);
+int mb_dict_lookup(uint8_t, uint32_t, uint64_t, mb_clock *);
+const char *mb_dict_name(void);
+
+/* decoder kernels (mb_decoder.c): truncated binary code reads of the
+   stream above, and string expansion of strings of len bytes */
+int mb_dec_truncated(const uint32_t *, uint64_t, uint8_t, const uint8_t *, size_t, mb_clock *);
+int mb_expand(uint8_t, uint32_t, uint64_t, mb_clock *);
+
+#endif
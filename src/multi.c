@@ -0,0 +1,384 @@
+#include "multi.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <libgen.h>       /* basename */
+#include <sys/stat.h>
+
+#include "shared.h"
+#include "compress_lzw.h"
+#include "decompress_lzw.h"
+#include "workqueue.h"
+
+#define MULTI_SUFFIX  ".lzw"
+
+typedef struct multi_file
+{
+    char    *src, *dst;
+    const char *dst_name;      /* dopo l'ultima '/' di dst */
+    dev_t    dst_dev;          /* directory di dst */
+    ino_t    dst_ino;
+    uint64_t in_bytes, out_bytes;
+    int      status;      /* 0 ok, -1 error */
+} multi_file;
+
+typedef struct multi_job
+{
+    const multi_opts *opts;
+    multi_file *files;
+    uint32_t    n_files, size;
+    uint32_t    errors;            /* percorsi non leggibili */
+    struct lzw_context_enc **enc;  /* uno per worker */
+    struct lzw_context_dec **dec;
+} multi_job;
+
+static bool has_suffix(const char *name)
+{
+    size_t len = strlen(name);
+
+    return len > strlen(MULTI_SUFFIX) &&
+           !strcmp(name + len - strlen(MULTI_SUFFIX), MULTI_SUFFIX);
+}
+
+static char *str_cat3(const char *a, const char *b, const char *c)
+{
+    char *s = my_malloc(strlen(a) + strlen(b) + strlen(c) + 1);
+
+    strcpy(s, a);
+    strcat(s, b);
+    strcat(s, c);
+    return s;
+}
+
+/* crea le directory di path sotto output_dir */
+static int mkdir_parents(char *path, size_t from)
+{
+    char *p;
+
+    for (p = path + from; (p = strchr(p, '/')); p++)
+    {
+        *p = '\0';
+        if (mkdir(path, 0755) && errno != EEXIST)
+        {
+            perror(path);
+            *p = '/';
+            return -1;
+        }
+        *p = '/';
+    }
+    return 0;
+}
+
+/* la directory di dst si confronta per identità, non per nome: "a/x" e
+   "./a/x" senza output_dir scrivono lo stesso file */
+static int multi_dst_key(multi_file *f)
+{
+    struct stat st;
+    char *slash = strrchr(f->dst, '/');
+    int ret;
+
+    f->dst_name = slash ? slash + 1 : f->dst;
+    if (!slash)
+        ret = stat(".", &st);
+    else if (slash == f->dst)
+        ret = stat("/", &st);
+    else
+    {
+        *slash = '\0';
+        ret = stat(f->dst, &st);
+        *slash = '/';
+    }
+
+    if (ret)
+    {
+        perror(f->dst);
+        return -1;
+    }
+    f->dst_dev = st.st_dev;
+    f->dst_ino = st.st_ino;
+    return 0;
+}
+
+static int multi_dst_cmp(const void *a, const void *b)
+{
+    const multi_file *fa = *(multi_file *const *)a, *fb = *(multi_file *const *)b;
+
+    if (fa->dst_dev != fb->dst_dev)
+        return fa->dst_dev < fb->dst_dev ? -1 : 1;
+    if (fa->dst_ino != fb->dst_ino)
+        return fa->dst_ino < fb->dst_ino ? -1 : 1;
+    return strcmp(fa->dst_name, fb->dst_name);
+}
+
+/* input diversi con lo stesso output (file con lo stesso nome in directory
+   diverse, o lo stesso file due volte): i worker lo scriverebbero insieme,
+   falliscono tutti e nessuno lo crea */
+static void multi_collisions(multi_job *mj)
+{
+    multi_file **v = my_calloc(mj->n_files + 1, sizeof(multi_file *));
+    uint32_t i, j, n = 0;
+
+    for (i = 0; i < mj->n_files; i++)
+        if (!mj->files[i].status)
+            v[n++] = &mj->files[i];
+    qsort(v, n, sizeof(multi_file *), multi_dst_cmp);
+
+    for (i = 0; i < n; i = j)
+    {
+        for (j = i + 1; j < n && !multi_dst_cmp(&v[i], &v[j]); j++)
+        {
+            fprintf(stderr, "\"%s\" and \"%s\": same output \"%s\", skipped\n",
+                    v[i]->src, v[j]->src, v[j]->dst);
+            v[j]->status = -1;
+        }
+        if (j > i + 1)
+            v[i]->status = -1;
+    }
+
+    free(v);
+}
+
+/* rel è il nome relativo ad output_dir: il nome del file, o per i file
+   di una directory il nome della directory seguito dal percorso */
+static void multi_add(multi_job *mj, const char *src, const char *rel)
+{
+    const multi_opts *o = mj->opts;
+    multi_file *f;
+    char *base;
+
+    if (mj->n_files == mj->size)
+    {
+        mj->size = mj->size ? 2 * mj->size : 256;
+        if (!(mj->files = realloc(mj->files, mj->size * sizeof(multi_file))))
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    f = &mj->files[mj->n_files++];
+    memset(f, 0, sizeof(multi_file));
+
+    f->src = str_cat3(src, "", "");
+    base = o->output_dir ? str_cat3(o->output_dir, rel, "") : str_cat3(src, "", "");
+    if (o->compress)
+        f->dst = str_cat3(base, MULTI_SUFFIX, "");
+    else if (has_suffix(base))
+    {
+        base[strlen(base) - strlen(MULTI_SUFFIX)] = '\0';
+        f->dst = str_cat3(base, "", "");
+    }
+    free(base);
+
+    if (!f->dst)
+    {
+        fprintf(stderr, "\"%s\": not a %s file, skipped\n", src, MULTI_SUFFIX);
+        f->status = -1;
+    }
+    else if (!o->force && !access(f->dst, F_OK))
+    {
+        fprintf(stderr, "file \"%s\" already exists, use --force option.\n", f->dst);
+        f->status = -1;
+    }
+    else if (o->output_dir && mkdir_parents(f->dst, strlen(o->output_dir)))
+        f->status = -1;
+    else if (multi_dst_key(f))
+        f->status = -1;
+}
+
+/* file regolari dell'albero, senza seguire i link simbolici; comprimendo
+   si saltano i .lzw, decomprimendo si prendono solo quelli */
+static int multi_walk(multi_job *mj, const char *dir, const char *rel)
+{
+    struct dirent *de;
+    struct stat st;
+    char *path, *sub;
+    DIR *d;
+
+    if (!(d = opendir(dir)))
+    {
+        perror(dir);
+        mj->errors++;
+        return -1;
+    }
+
+    while ((de = readdir(d)))
+    {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+
+        path = str_cat3(dir, "/", de->d_name);
+        sub  = str_cat3(rel, "/", de->d_name);
+
+        if (lstat(path, &st))
+        {
+            perror(path);
+            mj->errors++;
+        }
+        else if (S_ISDIR(st.st_mode))
+            multi_walk(mj, path, sub);
+        else if (S_ISREG(st.st_mode) && has_suffix(de->d_name) != mj->opts->compress)
+            multi_add(mj, path, sub);
+
+        free(path);
+        free(sub);
+    }
+
+    closedir(d);
+    return 0;
+}
+
+static void multi_path(multi_job *mj, const char *path)
+{
+    struct stat st;
+    char *copy, *name;
+    size_t len;
+
+    if (stat(path, &st))
+    {
+        perror(path);
+        mj->errors++;
+        return;
+    }
+
+    /* basename può modificare la stringa, la '/' finale non conta */
+    copy = str_cat3(path, "", "");
+    while ((len = strlen(copy)) > 1 && copy[len - 1] == '/')
+        copy[len - 1] = '\0';
+    name = basename(copy);
+
+    if (S_ISDIR(st.st_mode))
+        multi_walk(mj, copy, name);
+    else
+        multi_add(mj, path, name);
+
+    free(copy);
+}
+
+static int multi_list(multi_job *mj, const char *list)
+{
+    FILE *f = strcmp(list, "-") ? fopen(list, "r") : stdin;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+
+    if (!f)
+    {
+        perror(list);
+        return -1;
+    }
+
+    while ((len = getline(&line, &size, f)) > 0)
+    {
+        if (line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (len)
+            multi_path(mj, line);
+    }
+
+    free(line);
+    if (f != stdin)
+        fclose(f);
+    return 0;
+}
+
+static void multi_file_job(void *arg, uint32_t job, uint32_t worker)
+{
+    multi_job *mj = arg;
+    const multi_opts *o = mj->opts;
+    multi_file *f = &mj->files[job];
+    struct stat st;
+    int fd_src, fd_dst;
+
+    if (f->status)
+        return;
+
+    if ((fd_src = open(f->src, O_RDONLY)) < 0)
+    {
+        perror(f->src);
+        f->status = -1;
+        return;
+    }
+
+    /* come con un file solo, un input vuoto non si (de)comprime */
+    if (!fstat(fd_src, &st))
+        f->in_bytes = st.st_size;
+    if (!f->in_bytes)
+    {
+        fprintf(stderr, "file \"%s\" is empty.\n", f->src);
+        close(fd_src);
+        f->status = -1;
+        return;
+    }
+
+    if ((fd_dst = open(f->dst, O_RDWR | O_CREAT | O_TRUNC, /* RDWR per mmap */
+                       S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0)
+    {
+        perror(f->dst);
+        close(fd_src);
+        f->status = -1;
+        return;
+    }
+
+    /* le funzioni chiudono i fd */
+    if (o->compress)
+        f->status = compress_lzw_ctx_fd(&mj->enc[worker], fd_src, fd_dst,
+                                        o->ratio, o->reset, o->flags | LZW_FLAG_QUIET);
+    else
+        f->status = decompress_lzw_ctx_fd(&mj->dec[worker], fd_src, fd_dst,
+                                          o->flags | LZW_FLAG_QUIET);
+
+    if (f->status)
+    {
+        fprintf(stderr, "\"%s\": failed\n", f->src);
+        unlink(f->dst);
+    }
+    else if (!stat(f->dst, &st))
+        f->out_bytes = st.st_size;
+}
+
+int multi_run(const multi_opts *opts, char **paths, uint32_t n_paths, bool lists,
+              multi_result *res)
+{
+    multi_job mj;
+    uint32_t i, workers = opts->workers ? opts->workers : 1;
+
+    memset(&mj, 0, sizeof(mj));
+    memset(res, 0, sizeof(multi_result));
+    mj.opts = opts;
+
+    /* la lista si fa prima, le directory di output si creano in sequenza */
+    for (i = 0; i < n_paths; i++)
+        if (!lists)
+            multi_path(&mj, paths[i]);
+        else if (multi_list(&mj, paths[i]))
+            mj.errors++;
+    res->failed = mj.errors;
+    multi_collisions(&mj);
+
+    mj.enc = my_calloc(workers, sizeof(struct lzw_context_enc *));
+    mj.dec = my_calloc(workers, sizeof(struct lzw_context_dec *));
+
+    workqueue_run(workers, mj.n_files, multi_file_job, &mj);
+
+    for (i = 0; i < workers; i++)
+    {
+        compress_lzw_ctx_delete(mj.enc[i]);
+        decompress_lzw_ctx_delete(mj.dec[i]);
+    }
+    free(mj.enc);
+    free(mj.dec);
+
+    for (i = 0; i < mj.n_files; i++)
+    {
+        res->files++;
+        if (mj.files[i].status)
+            res->failed++;
+        res->in_bytes  += mj.files[i].in_bytes;
+        res->out_bytes += mj.files[i].out_bytes;
+        free(mj.files[i].src);
+        free(mj.files[i].dst);
+    }
+    free(mj.files);
+
+    return res->failed ? -1 : 0;
+}
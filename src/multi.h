@@ -0,0 +1,31 @@
+#ifndef _MULTI_H_
+#define _MULTI_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* many files and directory trees (de)compressed concurrently, one file per
+   job, by a pool of workers that keep their dictionary tables across files */
+typedef struct multi_opts
+{
+    bool        compress;
+    uint8_t     ratio;
+    uint32_t    reset;
+    uint32_t    flags;       /* LZW_FLAG_* */
+    uint32_t    workers;
+    bool        force;
+    const char *output_dir;  /* with the trailing '/', NULL: next to the input */
+} multi_opts;
+
+typedef struct multi_result
+{
+    uint32_t files, failed;
+    uint64_t in_bytes, out_bytes;
+} multi_result;
+
+/* paths are files or directories, or with lists files with one of them per
+   line ("-" for stdin); returns 0 when every file went fine */
+int multi_run(const multi_opts *, char **paths, uint32_t n_paths, bool lists,
+              multi_result *);
+
+#endif
@@ -0,0 +1,136 @@
+#include "perfctr.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+static const char *perfctr_names[PERFCTR_MAX] =
+{
+    "cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses"
+};
+
+#ifdef __linux__
+#define CACHE_READ_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct
+{
+    uint32_t type;
+    uint64_t config;
+} perfctr_events[PERFCTR_MAX] =
+{
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+    { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+};
+
+int perfctr_open(perfctr *pc)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    memset(pc, 0, sizeof(*pc));
+    for (i = 0; i < PERFCTR_MAX; i++)
+    {
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = perfctr_events[i].type;
+        attr.config         = perfctr_events[i].config;
+        attr.disabled       = 1;
+        attr.inherit        = 1; /* anche i thread del workqueue */
+        attr.exclude_kernel = 1; /* basta perf_event_paranoid <= 2 */
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                              PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        /* i contatori che mancano (vm, permessi) restano a -1 */
+        pc->fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (pc->fd[i] >= 0)
+            n++;
+    }
+
+    return n;
+}
+
+void perfctr_start(perfctr *pc)
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_MAX; i++)
+        if (pc->fd[i] >= 0)
+        {
+            ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+}
+
+void perfctr_stop(perfctr *pc)
+{
+    uint64_t data[3]; /* valore, tempo abilitato, tempo in esecuzione */
+    int i;
+
+    for (i = 0; i < PERFCTR_MAX; i++)
+    {
+        pc->value[i] = 0;
+        if (pc->fd[i] < 0)
+            continue;
+
+        ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(pc->fd[i], data, sizeof(data)) != sizeof(data))
+        {
+            close(pc->fd[i]);
+            pc->fd[i] = -1;
+            continue;
+        }
+
+        /* con più eventi che contatori la pmu va a turno, si stima */
+        if (data[2] && data[2] < data[1])
+            pc->value[i] = (uint64_t)((double)data[0] * data[1] / data[2]);
+        else
+            pc->value[i] = data[0];
+    }
+}
+
+void perfctr_close(perfctr *pc)
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_MAX; i++)
+        if (pc->fd[i] >= 0)
+        {
+            close(pc->fd[i]);
+            pc->fd[i] = -1;
+        }
+}
+#else
+int perfctr_open(perfctr *pc)
+{
+    int i;
+
+    memset(pc, 0, sizeof(*pc));
+    for (i = 0; i < PERFCTR_MAX; i++)
+        pc->fd[i] = -1;
+    return 0;
+}
+
+void perfctr_start(perfctr *pc) { (void)pc; }
+void perfctr_stop(perfctr *pc)  { (void)pc; }
+void perfctr_close(perfctr *pc) { (void)pc; }
+#endif
+
+bool perfctr_valid(const perfctr *pc, int counter)
+{
+    return pc->fd[counter] >= 0;
+}
+
+const char *perfctr_name(int counter)
+{
+    return perfctr_names[counter];
+}
@@ -0,0 +1,35 @@
+#ifndef _PERFCTR_H_
+#define _PERFCTR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* hardware counters (Linux perf_event_open), user space only, inherited by
+   the worker threads started while they are enabled */
+enum
+{
+    PERFCTR_CYCLES = 0,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_LLC_MISSES,
+    PERFCTR_DTLB_MISSES,
+    PERFCTR_BRANCH_MISSES,
+    PERFCTR_MAX
+};
+
+typedef struct perfctr
+{
+    int      fd[PERFCTR_MAX];       /* < 0 when the counter is not available */
+    uint64_t value[PERFCTR_MAX];    /* scaled when the pmu was multiplexed */
+} perfctr;
+
+/* opens the counters disabled, returns how many are available (0 when
+   perf events are not permitted or not supported) */
+int  perfctr_open(perfctr *);
+void perfctr_start(perfctr *);
+void perfctr_stop(perfctr *);
+void perfctr_close(perfctr *);
+
+bool        perfctr_valid(const perfctr *, int counter);
+const char *perfctr_name(int counter);
+
+#endif
@@ -0,0 +1,49 @@
+#include "phase.h"
+
+#include <time.h>
+
+/* fase corrente del thread ed il suo inizio */
+static __thread int      phase_cur;
+static __thread uint64_t phase_start;
+
+static uint64_t phase_ns[PHASE_MAX];
+
+static const char *phase_names[PHASE_MAX] =
+{
+    "none", "alloc", "input", "code", "output", "teardown"
+};
+
+uint64_t phase_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int phase_switch(int phase)
+{
+    int prev = phase_cur;
+    uint64_t now;
+
+    if (phase == prev)
+        return prev;
+
+    now = phase_now();
+    if (prev != PHASE_NONE) /* più thread sommano nella stessa fase */
+        __atomic_fetch_add(&phase_ns[prev], now - phase_start, __ATOMIC_RELAXED);
+
+    phase_cur = phase;
+    phase_start = now;
+    return prev;
+}
+
+uint64_t phase_time(int phase)
+{
+    return __atomic_load_n(&phase_ns[phase], __ATOMIC_RELAXED);
+}
+
+const char *phase_name(int phase)
+{
+    return phase_names[phase];
+}
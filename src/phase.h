@@ -0,0 +1,30 @@
+#ifndef _PHASE_H_
+#define _PHASE_H_
+
+#include <stdint.h>
+
+/* per-phase time accounting of the (de)compress functions: each thread is
+   in one phase at a time and the time spent in it is added to a process
+   wide counter, so with threads the phases sum the time of all threads */
+enum
+{
+    PHASE_NONE = 0,  /* not accounted */
+    PHASE_ALLOC,     /* contexts and tables allocation */
+    PHASE_INPUT,     /* reads */
+    PHASE_CODE,      /* dictionary work and bit packing */
+    PHASE_OUTPUT,    /* writes */
+    PHASE_FREE,      /* teardown */
+    PHASE_MAX
+};
+
+/* monotonic time in nanoseconds */
+uint64_t phase_now(void);
+
+/* move the calling thread to a phase, returns the previous one */
+int      phase_switch(int phase);
+
+/* accounted nanoseconds of a phase, and its name */
+uint64_t    phase_time(int phase);
+const char *phase_name(int phase);
+
+#endif
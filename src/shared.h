@@ -34,7 +34,33 @@
 #define PACKAGE_STRING "dataroller 0.1.4"
 #define PACKAGE_VERSION "0.1.4"
 
-#define USE_TRUNCATE_BIT_ENCODING 1
+/* encoder dictionary entries packed in one 64 bit word (one cache line per
+   probe), -DUSE_SPLIT_HASH keeps the three separate tables for comparison */
+#ifndef USE_SPLIT_HASH
+#define USE_PACKED_HASH 1
+#endif
+
+/* runtime flags of the (de)compress functions */
+#define LZW_FLAG_MMAP  0x01   /* mmap input (encoder) and output (decoder) */
+#define LZW_FLAG_STATS 0x02   /* print dictionary statistics (USE_STATS builds) */
+#define LZW_FLAG_QUIET 0x04   /* no messages on stdout */
+#define LZW_FLAG_PIPELINE 0x08 /* reads and writes of single streams on I/O threads */
+#define LZW_FLAG_CHECKSUM 0x10 /* crc32c of the input after every stream (encoder) */
+#define LZW_FLAG_PLAIN    0x20 /* plain codes instead of truncated binary (encoder) */
+#define LZW_FLAG_STORE    0x40 /* incompressible segments stored as they are (encoder) */
+
+/* table max field of the headers: the table is reset only by CLEAR codes */
+#define LZW_TABLE_CLEAR  0x80000000
+/* the EOF code of every stream is followed by the crc32c (32 bits) of its
+   uncompressed data */
+#define LZW_TABLE_CHECKSUM 0x40000000
+/* codes are written with the full current width instead of truncated
+   binary, the decoder reads both */
+#define LZW_TABLE_PLAIN    0x20000000
+/* every EOF code is followed, from the next 64 bit word, by a 64 bit length:
+   0 ends the stream, otherwise that many bytes stored as they are (padded
+   to a whole word) come before the next codes */
+#define LZW_TABLE_STORED   0x10000000
 #define DEBUG 1
 
 #define max(a,b) \
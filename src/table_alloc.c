@@ -0,0 +1,112 @@
+#include "table_alloc.h"
+#include "shared.h"
+
+#include <sys/mman.h>
+
+#define TABLE_LINE       64          /* cache line */
+#define TABLE_HUGE_SIZE  (2 << 20)   /* huge page di x86-64 e arm64 */
+#define TABLE_MAP_MIN    TABLE_HUGE_SIZE /* sotto non serve una mappa propria */
+
+static int  table_huge = TABLE_HUGE_SYSTEM;
+static int  table_lock = TABLE_LOCK_NONE;
+static bool table_lock_failed;
+
+int table_alloc_policy(int huge, int lock)
+{
+    table_huge = huge;
+    table_lock = lock;
+
+    /* nei container con RLIMIT_MEMLOCK basso fallisce, si va avanti */
+    if (lock == TABLE_LOCK_ALL && mlockall(MCL_CURRENT | MCL_FUTURE))
+    {
+        perror("mlockall");
+        table_lock = TABLE_LOCK_NONE;
+        return -1;
+    }
+    return 0;
+}
+
+static size_t table_round(size_t size)
+{
+    return (size + TABLE_HUGE_SIZE - 1) & ~(size_t)(TABLE_HUGE_SIZE - 1);
+}
+
+/* mappa allineata alla huge page: si chiede una pagina in più e si
+   tagliano i bordi, così il kernel può usare huge page dall'inizio */
+static void *table_map(size_t size)
+{
+    uint8_t *p;
+    size_t head;
+
+    p = mmap(NULL, size + TABLE_HUGE_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    head = (TABLE_HUGE_SIZE - ((uintptr_t)p & (TABLE_HUGE_SIZE - 1))) & (TABLE_HUGE_SIZE - 1);
+    if (head)
+        munmap(p, head);
+    munmap(p + head + size, TABLE_HUGE_SIZE - head);
+
+    return p + head;
+}
+
+void *table_alloc(size_t size)
+{
+    void *p = NULL;
+
+    if (size < TABLE_MAP_MIN)
+    {
+        if (posix_memalign(&p, TABLE_LINE, size))
+            return NULL;
+        memset(p, 0, size);
+    }
+    else
+    {
+        size = table_round(size);
+
+#ifdef MAP_HUGETLB
+        /* il pool di huge page riservate può essere vuoto */
+        if (table_huge == TABLE_HUGE_EXPLICIT &&
+            (p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)) == MAP_FAILED)
+            p = NULL;
+#endif
+        if (!p)
+        {
+            if (!(p = table_map(size)))
+                return NULL;
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+            /* con defrag=madvise il fault della huge page può compattare la
+               memoria in modo sincrono, per questo non è il default */
+            if (table_huge == TABLE_HUGE_NONE)
+                madvise(p, size, MADV_NOHUGEPAGE);
+            else if (table_huge != TABLE_HUGE_SYSTEM)
+                madvise(p, size, MADV_HUGEPAGE);
+#endif
+        }
+    }
+
+    if (table_lock == TABLE_LOCK_TABLES && mlock(p, size) && !table_lock_failed)
+    {
+        table_lock_failed = true;
+        perror("mlock");
+    }
+
+    return p;
+}
+
+void table_free(void *table, size_t size)
+{
+    if (!table)
+        return;
+
+    if (size < TABLE_MAP_MIN)
+    {
+        if (table_lock == TABLE_LOCK_TABLES)
+            munlock(table, size);
+        free(table);
+    }
+    else
+        munmap(table, table_round(size));
+}
@@ -0,0 +1,26 @@
+#ifndef _TABLE_ALLOC_H_
+#define _TABLE_ALLOC_H_
+
+#include <stddef.h>
+
+/* huge page policy of the dictionary tables */
+#define TABLE_HUGE_NONE      0   /* normal pages (MADV_NOHUGEPAGE) */
+#define TABLE_HUGE_SYSTEM    1   /* as configured in transparent_hugepage, default */
+#define TABLE_HUGE_THP       2   /* transparent huge pages (MADV_HUGEPAGE) */
+#define TABLE_HUGE_EXPLICIT  3   /* MAP_HUGETLB from the reserved pool, THP if empty */
+
+/* memory locking policy */
+#define TABLE_LOCK_NONE      0   /* default */
+#define TABLE_LOCK_TABLES    1   /* mlock the dictionary tables only */
+#define TABLE_LOCK_ALL       2   /* mlockall(MCL_CURRENT | MCL_FUTURE) */
+
+/* process wide, set before the first allocation. returns -1 when the lock
+   policy can't be applied (the caller can go on without it) */
+int   table_alloc_policy(int huge, int lock);
+
+/* zeroed and cache line aligned, large tables on their own mapping aligned
+   to the huge page size. table_free wants the same size */
+void *table_alloc(size_t size);
+void  table_free(void *table, size_t size);
+
+#endif
@@ -5,22 +5,22 @@
 
 double timer_diff(timer *time)
 { 
-  struct timeval diff;
+  struct timespec diff;
 
   diff.tv_sec  = time->stop.tv_sec - time->start.tv_sec ;
-  diff.tv_usec = time->stop.tv_usec - time->start.tv_usec;
+  diff.tv_nsec = time->stop.tv_nsec - time->start.tv_nsec;
 
-  return (double)(diff.tv_sec + (double)diff.tv_usec / (double)1000000); 
+  return (double)(diff.tv_sec + (double)diff.tv_nsec / (double)1000000000); 
 }
 
 void timer_start(timer *time)
 {
-    gettimeofday(&time->start, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &time->start);
 }
 
 void timer_stop(timer *time)
 {
-    gettimeofday(&time->stop, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &time->stop);
 }
 
 void time2human(double seconds)
@@ -1,13 +1,13 @@
 #ifndef _TIMER_H_
 #define _TIMER_H_
 
-#include <sys/time.h>
 #include <time.h>
 
+/* monotonic wall clock, not affected by clock adjustments */
 typedef struct timer
 {
-    struct timeval start;
-    struct timeval stop;
+    struct timespec start;
+    struct timespec stop;
 } timer;
 
 void   timer_start(timer *time);
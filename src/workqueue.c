@@ -0,0 +1,89 @@
+#include "workqueue.h"
+#include "shared.h"
+
+#include <pthread.h>
+
+typedef struct workqueue
+{
+    pthread_mutex_t lock;
+    uint32_t     next_job, n_jobs;
+    workqueue_fn fn;
+    void        *arg;
+} workqueue;
+
+typedef struct worker
+{
+    workqueue *wq;
+    uint32_t   id;
+} worker;
+
+static void *worker_loop(void *data)
+{
+    worker *w = data;
+    uint32_t job;
+
+    while (1)
+    {
+        pthread_mutex_lock(&w->wq->lock);
+        job = w->wq->next_job++;
+        pthread_mutex_unlock(&w->wq->lock);
+
+        if (job >= w->wq->n_jobs)
+            break;
+
+        w->wq->fn(w->wq->arg, job, w->id);
+    }
+
+    return NULL;
+}
+
+int workqueue_run(uint32_t n_threads, uint32_t n_jobs, workqueue_fn fn, void *arg)
+{
+    workqueue wq;
+    pthread_t *threads;
+    worker    *workers;
+    uint32_t   i, started;
+
+    assert(fn);
+
+    if (n_threads > n_jobs)
+        n_threads = n_jobs;
+
+    /* niente thread per un solo worker */
+    if (n_threads <= 1)
+    {
+        for (i = 0; i < n_jobs; i++)
+            fn(arg, i, 0);
+        return 0;
+    }
+
+    wq.next_job = 0;
+    wq.n_jobs = n_jobs;
+    wq.fn = fn;
+    wq.arg = arg;
+    pthread_mutex_init(&wq.lock, NULL);
+
+    threads = my_calloc(n_threads, sizeof(pthread_t));
+    workers = my_calloc(n_threads, sizeof(worker));
+
+    for (started = 0; started < n_threads; started++)
+    {
+        workers[started].wq = &wq;
+        workers[started].id = started;
+        if (pthread_create(&threads[started], NULL, worker_loop, &workers[started]))
+            break;
+    }
+
+    /* se nessun thread è partito eseguiamo tutto qui */
+    if (!started)
+        worker_loop(&(worker){ &wq, 0 });
+
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&wq.lock);
+    free(workers);
+    free(threads);
+
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+#include <stdint.h>
+
+/* job callback: job is the job index, worker the index of the running thread */
+typedef void (*workqueue_fn)(void *arg, uint32_t job, uint32_t worker);
+
+/* run n_jobs jobs on (at most) n_threads threads, returns when all jobs are done */
+int workqueue_run(uint32_t n_threads, uint32_t n_jobs, workqueue_fn fn, void *arg);
+
+#endif
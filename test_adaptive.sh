@@ -0,0 +1,36 @@
+#!/bin/sh
+
+binary=${1:-./dataroller}
+tmp=$(mktemp -d)
+fail=0
+
+# input a fasi: casuale, zeri, testo, di nuovo casuale
+head -c 1000000 /dev/urandom > $tmp/mixed
+head -c 1000000 /dev/zero >> $tmp/mixed
+seq 1 200000 >> $tmp/mixed
+head -c 500000 /dev/urandom >> $tmp/mixed
+
+# il reset adattivo non deve costare molto più del reset a dizionario pieno
+for r in 0 2 4 10; do
+  $binary -f -r $r -c $tmp/mixed -o $tmp/full.lzw > /dev/null
+  $binary -f -r $r --reset adaptive -c $tmp/mixed -o $tmp/adaptive.lzw > /dev/null
+  full=$(wc -c < $tmp/full.lzw)
+  adaptive=$(wc -c < $tmp/adaptive.lzw)
+
+  if [ $((adaptive * 100)) -gt $((full * 110)) ]; then
+    echo "failure!! *** ratio $r: adaptive $adaptive bytes, full $full bytes ***"
+    fail=1
+  fi
+
+  $binary -f -d $tmp/adaptive.lzw -o $tmp/out > /dev/null
+  if ! cmp -s $tmp/mixed $tmp/out; then
+    echo "failure!! *** ratio $r: adaptive roundtrip ***"
+    fail=1
+  fi
+done
+
+rm -rf $tmp
+if [ $fail = 0 ]; then
+  echo "success!! *** adaptive reset checks passed ***"
+fi
+exit $fail
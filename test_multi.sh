@@ -0,0 +1,43 @@
+#!/bin/sh
+
+binary=${1:-./dataroller}
+tmp=$(mktemp -d)
+fail=0
+
+mkdir -p $tmp/a $tmp/b $tmp/tree/sub
+head -c 300000 /dev/urandom > $tmp/a/x
+seq 1 50000 > $tmp/b/x
+seq 1 20000 > $tmp/tree/y
+seq 5 30000 > $tmp/tree/sub/z
+: > $tmp/empty
+
+# due file con lo stesso nome in directory diverse: stesso output, si rifiuta
+if $binary -c $tmp/a/x -c $tmp/b/x -t 2 $tmp/out > /dev/null 2>&1; then
+  echo "failure!! *** same output name accepted ***"
+  fail=1
+fi
+if [ -e $tmp/out/x.lzw ]; then
+  echo "failure!! *** colliding output written ***"
+  fail=1
+fi
+
+# un input vuoto fallisce come con un file solo
+if $binary -c $tmp/empty -c $tmp/tree/y -t 2 $tmp/out > /dev/null 2>&1; then
+  echo "failure!! *** empty input accepted ***"
+  fail=1
+fi
+
+# albero: compressione e decompressione
+rm -rf $tmp/out $tmp/back
+if ! $binary -c $tmp/tree -t 2 $tmp/out > /dev/null ||
+   ! $binary -d $tmp/out/tree -t 2 $tmp/back > /dev/null ||
+   ! diff -r $tmp/tree $tmp/back/tree > /dev/null; then
+  echo "failure!! *** tree roundtrip ***"
+  fail=1
+fi
+
+rm -rf $tmp
+if [ $fail = 0 ]; then
+  echo "success!! *** multi-file checks passed ***"
+fi
+exit $fail